@@ -0,0 +1,37 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace relay
+{
+    // immutable reference counted data, shared by everything that sends it
+    class Buffer
+    {
+    public:
+        Buffer() {}
+        explicit Buffer(std::vector<uint8_t> aData):
+            data(std::make_shared<const std::vector<uint8_t>>(std::move(aData)))
+        {
+        }
+
+        const uint8_t* getData() const { return data ? data->data() : nullptr; }
+        size_t getSize() const { return data ? data->size() : 0; }
+        bool isEmpty() const { return getSize() == 0; }
+
+        // the whole data, for decoding functions that take a vector
+        const std::vector<uint8_t>& getVector() const
+        {
+            static const std::vector<uint8_t> empty;
+            return data ? *data : empty;
+        }
+
+    private:
+        std::shared_ptr<const std::vector<uint8_t>> data;
+    };
+}
@@ -0,0 +1,53 @@
+//
+//  rtmp_relay
+//
+
+#include <algorithm>
+#include <cstring>
+#include "ByteQueue.hpp"
+
+namespace relay
+{
+    void ByteQueue::append(const uint8_t* data, size_t size)
+    {
+        if (size == 0) return;
+
+        memcpy(prepare(size), data, size);
+        commit(size);
+    }
+
+    uint8_t* ByteQueue::prepare(size_t size)
+    {
+        // the storage is kept, so this only allocates and clears while the queue grows
+        if (buffer.size() - end < size) buffer.resize(end + size);
+
+        return buffer.data() + end;
+    }
+
+    void ByteQueue::consume(size_t size)
+    {
+        offset += size;
+
+        if (offset >= end)
+        {
+            // keep the storage for the next data
+            offset = 0;
+            end = 0;
+        }
+        else if (offset >= end - offset)
+        {
+            // moves at most as many bytes as were consumed since the last move
+            std::copy(buffer.begin() + static_cast<std::ptrdiff_t>(offset),
+                      buffer.begin() + static_cast<std::ptrdiff_t>(end),
+                      buffer.begin());
+            end -= offset;
+            offset = 0;
+        }
+    }
+
+    void ByteQueue::clear()
+    {
+        offset = 0;
+        end = 0;
+    }
+}
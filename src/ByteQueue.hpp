@@ -0,0 +1,40 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace relay
+{
+    // contiguous queue of bytes, the consumed bytes are reclaimed lazily so that consuming is O(1)
+    class ByteQueue
+    {
+    public:
+        // the queued bytes are between the offset and the end of the buffer
+        const uint8_t* getBuffer() const { return buffer.data(); }
+        size_t getOffset() const { return offset; }
+        size_t getEnd() const { return end; }
+
+        const uint8_t* getData() const { return buffer.data() + offset; }
+        size_t getSize() const { return end - offset; }
+        bool isEmpty() const { return end == offset; }
+
+        void append(const uint8_t* data, size_t size);
+        void append(const std::vector<uint8_t>& data) { append(data.data(), data.size()); }
+        // space for at least the given amount of bytes after the queued ones, commit queues the written part of it
+        uint8_t* prepare(size_t size);
+        void commit(size_t size) { end += size; }
+        void consume(size_t size);
+        void clear();
+
+    private:
+        // the storage is only initialized when it grows, so the bytes after the end are reused without clearing them
+        std::vector<uint8_t> buffer;
+        size_t offset = 0;
+        size_t end = 0;
+    };
+}
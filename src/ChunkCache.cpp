@@ -0,0 +1,58 @@
+//
+//  rtmp_relay
+//
+
+#include <algorithm>
+#include "ChunkCache.hpp"
+
+namespace relay
+{
+    Buffer ChunkCache::getChunks(const Buffer& newPayload, uint32_t chunkSize, const std::vector<uint8_t>& nextHeader)
+    {
+        // a single chunk is the payload itself
+        if (newPayload.getSize() <= chunkSize) return newPayload;
+
+        // the cached payload is retained, so its data pointer identifies it
+        if (payload.getData() != newPayload.getData())
+        {
+            payload = newPayload;
+            entries.clear();
+        }
+
+        for (const Entry& entry : entries)
+        {
+            if (entry.chunkSize == chunkSize && entry.nextHeader == nextHeader)
+            {
+                return entry.chunks;
+            }
+        }
+
+        size_t size = payload.getSize();
+        const uint8_t* data = payload.getData();
+
+        std::vector<uint8_t> buffer;
+        buffer.reserve(size + (size / chunkSize) * nextHeader.size());
+
+        for (size_t offset = 0; offset < size; offset += chunkSize)
+        {
+            if (offset > 0) buffer.insert(buffer.end(), nextHeader.begin(), nextHeader.end());
+
+            size_t chunk = std::min(size - offset, static_cast<size_t>(chunkSize));
+            buffer.insert(buffer.end(), data + offset, data + offset + chunk);
+        }
+
+        Entry entry;
+        entry.chunkSize = chunkSize;
+        entry.nextHeader = nextHeader;
+        entry.chunks = Buffer(std::move(buffer));
+        entries.push_back(entry);
+
+        return entry.chunks;
+    }
+
+    void ChunkCache::clear()
+    {
+        payload = Buffer();
+        entries.clear();
+    }
+}
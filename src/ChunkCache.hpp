@@ -0,0 +1,34 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "Buffer.hpp"
+
+namespace relay
+{
+    // serialized chunks of the last sent payload, shared by the outputs that use the same chunking
+    class ChunkCache
+    {
+    public:
+        // the payload split into chunks of the given size, with the header of the following chunks between them,
+        // without the header of the first chunk
+        Buffer getChunks(const Buffer& payload, uint32_t chunkSize, const std::vector<uint8_t>& nextHeader);
+
+        void clear();
+
+    private:
+        struct Entry
+        {
+            uint32_t chunkSize;
+            std::vector<uint8_t> nextHeader;
+            Buffer chunks;
+        };
+
+        Buffer payload;
+        std::vector<Entry> entries;
+    };
+}
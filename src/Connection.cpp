@@ -2,6 +2,7 @@
 //  rtmp_relay
 //
 
+#include <algorithm>
 #include <sstream>
 #include <iostream>
 #include <iomanip>
@@ -15,19 +16,32 @@
 
 namespace relay
 {
+    static const float IDLE_TIMEOUT = 5.0f;
+
     Connection::Connection(Relay& aRelay,
                            Socket& client):
         relay(aRelay),
         id(Relay::nextId()),
         type(Type::HOST),
-        socket(std::move(client))
+        socket(std::move(client)),
+        pingTimer(relay.getNetwork()),
+        pongTimer(relay.getNetwork()),
+        reconnectTimer(relay.getNetwork()),
+        idleTimer(relay.getNetwork()),
+        measureTimer(relay.getNetwork())
     {
         updateIdString();
-        Log(Log::Level::INFO) << idString << "Create connection";
+        socket.setTraceId(id);
+        RELAY_LOG(Log::Level::INFO) << idString << "Create connection";
 
         socket.setReadCallback(std::bind(&Connection::handleRead, this, std::placeholders::_1, std::placeholders::_2));
         socket.setCloseCallback(std::bind(&Connection::handleClose, this, std::placeholders::_1));
+        socket.setWriteCallback(std::bind(&Connection::handleWrite, this, std::placeholders::_1));
         socket.startRead();
+
+        lastDataTime = std::chrono::steady_clock::now();
+        idleTimer.start(IDLE_TIMEOUT, std::bind(&Connection::handleIdle, this, std::placeholders::_1));
+        measureTimer.start(1.0f, std::bind(&Connection::handleMeasure, this, std::placeholders::_1), true);
     }
 
     Connection::Connection(Relay& aRelay,
@@ -37,46 +51,173 @@ namespace relay
         id(Relay::nextId()),
         type(Type::CLIENT),
         socket(relay.getNetwork()),
+        pingTimer(relay.getNetwork()),
+        pongTimer(relay.getNetwork()),
+        reconnectTimer(relay.getNetwork()),
+        idleTimer(relay.getNetwork()),
+        measureTimer(relay.getNetwork()),
         endpoint(&aEndpoint)
     {
-        updateIdString();
-        stream = &aStream;
-
-        resolveStreamName();
-        Log(Log::Level::INFO) << idString << "Create connection";
-
         reconnectCount = endpoint->reconnectCount;
         bufferSize = endpoint->bufferSize;
         direction = endpoint->direction;
         amfVersion = endpoint->amfVersion;
 
+        updateIdString();
+        socket.setTraceId(id);
+        stream = &aStream;
+
+        resolveStreamName();
+        RELAY_LOG(Log::Level::INFO) << idString << "Create connection";
+
         socket.setReadCallback(std::bind(&Connection::handleRead, this, std::placeholders::_1, std::placeholders::_2));
         socket.setCloseCallback(std::bind(&Connection::handleClose, this, std::placeholders::_1));
+        socket.setWriteCallback(std::bind(&Connection::handleWrite, this, std::placeholders::_1));
         socket.setConnectTimeout(endpoint->connectionTimeout);
+        socket.setOptions(endpoint->socketOptions);
+        if (direction == Direction::OUTPUT) socket.setZeroCopyThreshold(endpoint->zeroCopyThreshold);
         socket.setConnectCallback(std::bind(&Connection::handleConnect, this, std::placeholders::_1));
         socket.setConnectErrorCallback(std::bind(&Connection::handleConnectError, this, std::placeholders::_1));
+
+        measureTimer.start(1.0f, std::bind(&Connection::handleMeasure, this, std::placeholders::_1), true);
+    }
+
+    Connection::Connection(Relay& aRelay,
+                           Handover& handover):
+        relay(aRelay),
+        id(handover.id),
+        type(Type::HOST),
+        socket(relay.getNetwork(), handover.socketFd, true,
+               handover.localIPAddress, handover.localPort,
+               handover.remoteIPAddress, handover.remotePort),
+        pingTimer(relay.getNetwork()),
+        pongTimer(relay.getNetwork()),
+        reconnectTimer(relay.getNetwork()),
+        idleTimer(relay.getNetwork()),
+        measureTimer(relay.getNetwork()),
+        inChunkSize(handover.inChunkSize),
+        outChunkSize(handover.outChunkSize),
+        serverBandwidth(handover.serverBandwidth),
+        receivedPackets(std::move(handover.receivedPackets)),
+        sentPackets(std::move(handover.sentPackets)),
+        invokeId(handover.invokeId),
+        invokes(std::move(handover.invokes)),
+        streamId(handover.streamId),
+        direction(handover.direction),
+        applicationName(std::move(handover.applicationName)),
+        streamName(std::move(handover.streamName)),
+        connected(handover.connected),
+        amfVersion(handover.amfVersion)
+    {
+        state = handover.state;
+        socket.getInData().append(handover.data);
+        updateIdString();
+        socket.setTraceId(id);
+        RELAY_LOG(Log::Level::INFO) << idString << "Adopt connection";
+
+        socket.setReadCallback(std::bind(&Connection::handleRead, this, std::placeholders::_1, std::placeholders::_2));
+        socket.setCloseCallback(std::bind(&Connection::handleClose, this, std::placeholders::_1));
+        socket.setWriteCallback(std::bind(&Connection::handleWrite, this, std::placeholders::_1));
+        socket.startRead();
+        socket.send(handover.outData);
+
+        lastDataTime = std::chrono::steady_clock::now();
+        idleTimer.start(IDLE_TIMEOUT, std::bind(&Connection::handleIdle, this, std::placeholders::_1));
+        measureTimer.start(1.0f, std::bind(&Connection::handleMeasure, this, std::placeholders::_1), true);
+
+        // the new owner handles the publish or play and the data that was received after it
+        handlePacket(handover.packet);
+        handleRead(socket, socket.getInData());
     }
 
     Connection::~Connection()
     {
         close();
-        Log(Log::Level::INFO) << idString << "Delete connection";
+        RELAY_LOG(Log::Level::INFO) << idString << "Delete connection";
     }
 
     void Connection::updateIdString()
     {
         idString = "[CON:" + std::to_string(id) + " " + applicationName + "/" + streamName + "] ";
+
+        metrics.setLabels(id, type == Type::HOST,
+                          direction == Direction::INPUT ? "input" : (direction == Direction::OUTPUT ? "output" : "none"),
+                          applicationName, streamName);
+    }
+
+    bool Connection::startHandover(const rtmp::Packet& packet)
+    {
+        if (type != Type::HOST) return false;
+
+        Relay& shard = relay.getShard(applicationName, streamName);
+        if (&shard == &relay) return false;
+
+        // the rest of the data is moved after the current packet is handled
+        handoverRelay = &shard;
+        handoverPacket = packet;
+
+        return true;
+    }
+
+    void Connection::finishHandover()
+    {
+        std::shared_ptr<Handover> handover = std::make_shared<Handover>();
+
+        handover->id = id;
+        handover->localIPAddress = socket.getLocalIPAddress();
+        handover->localPort = socket.getLocalPort();
+        handover->remoteIPAddress = socket.getRemoteIPAddress();
+        handover->remotePort = socket.getRemotePort();
+        const ByteQueue& data = socket.getInData();
+        handover->data.assign(data.getData(), data.getData() + data.getSize());
+        handover->socketFd = socket.release(handover->outData);
+
+        if (handover->socketFd == INVALID_SOCKET)
+        {
+            Log(Log::Level::ERR) << idString << "Failed to hand over the connection, disconnecting";
+            handoverRelay = nullptr;
+            close(true);
+            return;
+        }
+        handover->packet = std::move(handoverPacket);
+        handover->state = state;
+        handover->inChunkSize = inChunkSize;
+        handover->outChunkSize = outChunkSize;
+        handover->serverBandwidth = serverBandwidth;
+        handover->receivedPackets = std::move(receivedPackets);
+        handover->sentPackets = std::move(sentPackets);
+        handover->invokeId = invokeId;
+        handover->invokes = std::move(invokes);
+        handover->streamId = streamId;
+        handover->direction = direction;
+        handover->applicationName = applicationName;
+        handover->streamName = streamName;
+        handover->connected = connected;
+        handover->amfVersion = amfVersion;
+
+        Relay* target = handoverRelay;
+        handoverRelay = nullptr;
+
+        RELAY_LOG(Log::Level::INFO) << idString << "Handing over to the worker of the stream";
+
+        closed = true;
+        reset();
+        relay.cleanup();
+
+        target->post(std::bind(&Relay::adoptConnection, target, handover));
     }
 
     void Connection::close(bool forceClose)
     {
         if (closed) return;
 
-        Log(Log::Level::INFO) << idString << "Close called";
+        RELAY_LOG(Log::Level::INFO) << idString << "Close called";
         closed = closed || forceClose;
         socket.close(forceClose);
 
         reset();
+
+        relay.cleanup();
     }
 
     void Connection::reset()
@@ -84,8 +225,13 @@ namespace relay
         if (stream && streaming) stream->stop(*this);
         streaming = false;
 
+        if (state != State::UNINITIALIZED && state != State::HANDSHAKE_DONE)
+        {
+            Metrics::addHandshakeFailure();
+        }
+
         state = State::UNINITIALIZED;
-        data.clear();
+        socket.getInData().clear();
         receivedPackets.clear();
         sentPackets.clear();
         inChunkSize = 128;
@@ -95,16 +241,39 @@ namespace relay
         sentPackets.clear();
         invokeId = 0;
         invokes.clear();
-        timeSinceMeasure = 0.0f;
         connected = false;
         videoFrameSent = false;
+        videoFrameDropped = false;
+        queuedFrames.clear();
         metaData = amf::Node();
         currentAudioBytes = 0;
         currentVideoBytes = 0;
         audioRate = 0;
         videoRate = 0;
+        metrics.audioBitrate.store(0, std::memory_order_relaxed);
+        metrics.videoBitrate.store(0, std::memory_order_relaxed);
         amfVersion = amf::Version::AMF0;
 
+        pingTimer.stop();
+        pongTimer.stop();
+        idleTimer.stop();
+
+        if (closed)
+        {
+            reconnectTimer.stop();
+            measureTimer.stop();
+        }
+        else
+        {
+            measureTimer.start(1.0f, std::bind(&Connection::handleMeasure, this, std::placeholders::_1), true);
+
+            // keep reconnecting until the connection is closed
+            if (type == Type::CLIENT && endpoint)
+            {
+                reconnectTimer.start(endpoint->reconnectInterval, std::bind(&Connection::handleReconnect, this, std::placeholders::_1), true);
+            }
+        }
+
         // disconnect all host connections
         if (type == Type::HOST)
         {
@@ -121,89 +290,84 @@ namespace relay
         return (type == Type::HOST && !socket.isReady()) || closed;
     }
 
-    void Connection::update(float delta)
+    void Connection::startPing()
     {
-        if (closed) return;
-
-        if (socket.isReady())
+        if (type == Type::HOST && connected && pingInterval > 0.0f)
         {
-            timeSinceLastData += delta;
-            if (timeSinceLastData > 5.0f)
-            {
-                Log(Log::Level::INFO) << idString << "Disconnecting as no data for 5s";
-                timeSinceLastData = 0;
-                close(type == Connection::Type::HOST);
-            }
+            pingTimer.start(pingInterval, std::bind(&Connection::handlePing, this, std::placeholders::_1), true);
+            pongTimer.start(2 * pingInterval, std::bind(&Connection::handlePongTimeout, this, std::placeholders::_1));
         }
-
-        if (type == Type::HOST)
+        else
         {
-            if (connected && pingInterval > 0.0f)
-            {
-                timeSincePing += delta;
-                timeSincePong += delta;
-
-                if (timeSincePing >= pingInterval)
-                {
-                    timeSincePing = 0.0f;
-                    sendUserControl(rtmp::UserControlType::PING);
-                }
-
-                if (timeSincePong >= 2 * pingInterval)
-                {
-                    Log(Log::Level::INFO) << idString << "Disconnecting as no pong";
-                    close(true);
-                }
-            }
+            pingTimer.stop();
+            pongTimer.stop();
         }
-        else if (type == Type::CLIENT)
-        {
-            if (!endpoint) return;
+    }
 
-            if (socket.isReady() && state == State::HANDSHAKE_DONE)
-            {
-                timeSinceConnect = 0.0f;
-            }
-            else
-            {
-                timeSinceConnect += delta;
+    void Connection::handlePing(Timer&)
+    {
+        sendUserControl(rtmp::UserControlType::PING);
+    }
 
-                if (timeSinceConnect >= endpoint->reconnectInterval)
-                {
-                    timeSinceConnect = 0.0f;
-                    state = State::UNINITIALIZED;
+    void Connection::handlePongTimeout(Timer&)
+    {
+        RELAY_LOG(Log::Level::INFO) << idString << "Disconnecting as no pong";
+        close(true);
+    }
 
-                    if (connectCount >= reconnectCount)
-                    {
-                        connectCount = 0;
-                        ++addressIndex;
-                    }
+    void Connection::handleReconnect(Timer&)
+    {
+        if (closed || !endpoint) return;
 
-                    if (addressIndex >= endpoint->addresses.size())
-                    {
-                        addressIndex = 0;
-                    }
+        state = State::UNINITIALIZED;
+        metrics.reconnects.fetch_add(1, std::memory_order_relaxed);
 
-                    if (addressIndex < endpoint->addresses.size())
-                    {
-                        socket.connect(endpoint->addresses[addressIndex].ipAddresses.first,
-                                       endpoint->addresses[addressIndex].ipAddresses.second);
-                    }
-                }
-            }
+        if (connectCount >= reconnectCount)
+        {
+            connectCount = 0;
+            ++addressIndex;
         }
 
-        timeSinceMeasure += delta;
+        if (addressIndex >= endpoint->addresses.size())
+        {
+            addressIndex = 0;
+        }
 
-        if (timeSinceMeasure >= 1.0f)
+        if (addressIndex < endpoint->addresses.size())
         {
-            timeSinceMeasure = 0.0f;
-            audioRate = currentAudioBytes;
-            videoRate = currentVideoBytes;
+            socket.connect(endpoint->addresses[addressIndex].ipAddresses.first,
+                           endpoint->addresses[addressIndex].ipAddresses.second);
+        }
+    }
 
-            currentAudioBytes = 0;
-            currentVideoBytes = 0;
+    void Connection::handleIdle(Timer&)
+    {
+        if (closed || !socket.isReady()) return;
+
+        auto idleTime = std::chrono::steady_clock::now() - lastDataTime;
+        float idleSeconds = std::chrono::duration_cast<std::chrono::milliseconds>(idleTime).count() / 1000.0f;
+
+        if (idleSeconds >= IDLE_TIMEOUT)
+        {
+            RELAY_LOG(Log::Level::INFO) << idString << "Disconnecting as no data for 5s";
+            close(type == Connection::Type::HOST);
         }
+        else
+        {
+            // data was sent or received since the timer was started
+            idleTimer.start(IDLE_TIMEOUT - idleSeconds, std::bind(&Connection::handleIdle, this, std::placeholders::_1));
+        }
+    }
+
+    void Connection::handleMeasure(Timer&)
+    {
+        audioRate = currentAudioBytes;
+        videoRate = currentVideoBytes;
+        metrics.audioBitrate.store(audioRate * 8, std::memory_order_relaxed);
+        metrics.videoBitrate.store(videoRate * 8, std::memory_order_relaxed);
+
+        currentAudioBytes = 0;
+        currentVideoBytes = 0;
     }
 
     void Connection::getStats(std::string& str, ReportType reportType) const
@@ -240,6 +404,10 @@ namespace relay
                     case Direction::OUTPUT: ss << "OUTPUT"; break;
                 }
 
+                ss << " " << std::setw(8) << (droppedVideoFrames + droppedAudioFrames);
+
+                ss << " " << std::setw(20) << latencyHistogram.getPercentilesString();
+
                 ss << " " << std::setw(6) << (stream ? std::to_string(stream->getServer().getId()) : "") << " ";
 
                 if (metaData.getType() == amf::Node::Type::Dictionary ||
@@ -291,6 +459,10 @@ namespace relay
                     case Direction::OUTPUT: str += "OUTPUT"; break;
                 }
 
+                str += "</td><td>" + std::to_string(droppedVideoFrames + droppedAudioFrames);
+
+                str += "</td><td>" + latencyHistogram.getPercentilesString();
+
                 str += "</td><td>" + (stream ? std::to_string(stream->getServer().getId()) : "") + "</td><td>";
 
                 if (metaData.getType() == amf::Node::Type::Dictionary ||
@@ -344,6 +516,17 @@ namespace relay
                     case Direction::OUTPUT: str += "\"OUTPUT\""; break;
                 }
 
+                str += ",\"droppedVideoFrames\":" + std::to_string(droppedVideoFrames) +
+                    ",\"droppedAudioFrames\":" + std::to_string(droppedAudioFrames);
+
+                if (latencyHistogram.getCount() > 0)
+                {
+                    str += ",\"latency\":{\"count\":" + std::to_string(latencyHistogram.getCount()) +
+                        ",\"p50\":" + std::to_string(latencyHistogram.getPercentile(0.5)) +
+                        ",\"p99\":" + std::to_string(latencyHistogram.getPercentile(0.99)) +
+                        ",\"p999\":" + std::to_string(latencyHistogram.getPercentile(0.999)) + "}";
+                }
+
                 if (stream) str += ",\"serverId\":" + std::to_string(stream->getServer().getId());
 
                 if (metaData.getType() == amf::Node::Type::Dictionary ||
@@ -383,6 +566,8 @@ namespace relay
     {
         if (!endpoint) return;
 
+        reconnectTimer.start(endpoint->reconnectInterval, std::bind(&Connection::handleReconnect, this, std::placeholders::_1), true);
+
         if (addressIndex < endpoint->addresses.size())
         {
             socket.connect(endpoint->addresses[addressIndex].ipAddresses.first,
@@ -401,14 +586,17 @@ namespace relay
         // handshake
         if (type == Type::CLIENT)
         {
-            Log(Log::Level::INFO) << idString << "Connected to " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort();
+            RELAY_LOG(Log::Level::INFO) << idString << "Connected to " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort();
+
+            lastDataTime = std::chrono::steady_clock::now();
+            idleTimer.start(IDLE_TIMEOUT, std::bind(&Connection::handleIdle, this, std::placeholders::_1));
 
             // C0
             std::vector<uint8_t> version;
             version.push_back(RTMP_VERSION);
             socket.send(version);
 
-            Log(Log::Level::ALL) << idString << "Sending version message " << RTMP_VERSION;
+            RELAY_LOG(Log::Level::ALL) << idString << "Sending version message " << RTMP_VERSION;
 
             // C1
             rtmp::Challenge challenge;
@@ -428,7 +616,7 @@ namespace relay
                                     reinterpret_cast<uint8_t*>(&challenge) + sizeof(challenge));
             socket.send(challengeMessage);
 
-            Log(Log::Level::ALL) << idString << "Sending challenge message";
+            RELAY_LOG(Log::Level::ALL) << idString << "Sending challenge message";
 
             state = State::VERSION_SENT;
         }
@@ -438,29 +626,42 @@ namespace relay
     {
     }
 
-    void Connection::handleRead(Socket&, const std::vector<uint8_t>& newData)
+    void Connection::handleRead(Socket&, ByteQueue& data)
     {
-        data.insert(data.end(), newData.begin(), newData.end());
+        metrics.receivedBytes.store(socket.getReceivedSize(), std::memory_order_relaxed);
 
-        Log(Log::Level::ALL) << idString << "Got " << std::to_string(newData.size()) << " bytes";
+        RELAY_LOG(Log::Level::ALL) << idString << "Got " << std::to_string(data.getSize()) << " bytes";
 
-        uint32_t offset = 0;
+        const uint8_t* buffer = data.getBuffer();
+        uint32_t bufferSize = static_cast<uint32_t>(data.getEnd());
+        uint32_t offset = static_cast<uint32_t>(data.getOffset());
 
-        while (offset < data.size())
+        while (offset < bufferSize)
         {
             if (state == State::HANDSHAKE_DONE)
             {
                 rtmp::Packet packet;
+                bool complete;
 
-                uint32_t ret = packet.decode(data, offset, inChunkSize, receivedPackets);
+                // chunks of incomplete messages are kept in receivedPackets
+                offset += packet.decode(buffer, bufferSize, offset, inChunkSize, receivedPackets, complete);
 
-                if (ret > 0)
+                if (complete)
                 {
-                    Log(Log::Level::ALL) << idString << "Total packet size: " << ret;
-
-                    offset += ret;
+                    metrics.receivedMessages.fetch_add(1, std::memory_order_relaxed);
+                    RELAY_LOG(Log::Level::ALL) << idString << "Total packet size: " << packet.data.size();
 
                     handlePacket(packet);
+
+                    if (handoverRelay)
+                    {
+                        data.consume(offset - data.getOffset());
+                        finishHandover();
+                        return;
+                    }
+
+                    // the packet closed the connection and reset() cleared the data
+                    if (state != State::HANDSHAKE_DONE) return;
                 }
                 else
                 {
@@ -471,17 +672,18 @@ namespace relay
             {
                 if (state == State::UNINITIALIZED)
                 {
-                    if (data.size() - offset >= sizeof(uint8_t))
+                    if (bufferSize - offset >= sizeof(uint8_t))
                     {
                         // C0
-                        uint8_t version = *(data.data() + offset);
+                        uint8_t version = *(buffer + offset);
                         offset += sizeof(version);
 
-                        Log(Log::Level::ALL) << idString << "Got version " << static_cast<uint32_t>(version);
+                        RELAY_LOG(Log::Level::ALL) << idString << "Got version " << static_cast<uint32_t>(version);
 
                         if (version != 0x03)
                         {
                             Log(Log::Level::ERR) << idString << "Unsupported version(" << version << "), disconnecting";
+                            Metrics::addHandshakeFailure();
                             close();
                             break;
                         }
@@ -490,7 +692,7 @@ namespace relay
                         std::vector<uint8_t> reply;
                         reply.push_back(RTMP_VERSION);
                         socket.send(reply);
-                        Log(Log::Level::ALL) << idString << "Sending reply version " << RTMP_VERSION;
+                        RELAY_LOG(Log::Level::ALL) << idString << "Sending reply version " << RTMP_VERSION;
 
                         state = State::VERSION_SENT;
                     }
@@ -501,13 +703,13 @@ namespace relay
                 }
                 else if (state == State::VERSION_SENT)
                 {
-                    if (data.size() - offset >= sizeof(rtmp::Challenge))
+                    if (bufferSize - offset >= sizeof(rtmp::Challenge))
                     {
                         // C1
-                        rtmp::Challenge* challenge = reinterpret_cast<rtmp::Challenge*>(data.data() + offset);
+                        const rtmp::Challenge* challenge = reinterpret_cast<const rtmp::Challenge*>(buffer + offset);
                         offset += sizeof(*challenge);
 
-                        Log(Log::Level::ALL) << idString << "Got challenge message, time: " << challenge->time <<
+                        RELAY_LOG(Log::Level::ALL) << idString << "Got challenge message, time: " << challenge->time <<
                         ", version: " << static_cast<uint32_t>(challenge->version[0]) << "." <<
                         static_cast<uint32_t>(challenge->version[1]) << "." <<
                         static_cast<uint32_t>(challenge->version[2]) << "." <<
@@ -530,7 +732,7 @@ namespace relay
                                      reinterpret_cast<uint8_t*>(&replyChallenge) + sizeof(replyChallenge));
                         socket.send(reply);
 
-                        Log(Log::Level::ALL) << idString << "Sending challange reply message";
+                        RELAY_LOG(Log::Level::ALL) << idString << "Sending challange reply message";
 
                         // S2
                         rtmp::Ack ack;
@@ -542,7 +744,7 @@ namespace relay
                                                      reinterpret_cast<uint8_t*>(&ack) + sizeof(ack));
                         socket.send(ackData);
 
-                        Log(Log::Level::ALL) << idString << "Sending Ack message";
+                        RELAY_LOG(Log::Level::ALL) << idString << "Sending Ack message";
 
                         state = State::ACK_SENT;
                     }
@@ -553,18 +755,18 @@ namespace relay
                 }
                 else  if (state == State::ACK_SENT)
                 {
-                    if (data.size() - offset >= sizeof(rtmp::Ack))
+                    if (bufferSize - offset >= sizeof(rtmp::Ack))
                     {
                         // C2
-                        rtmp::Ack* ack = reinterpret_cast<rtmp::Ack*>(data.data() + offset);
+                        const rtmp::Ack* ack = reinterpret_cast<const rtmp::Ack*>(buffer + offset);
                         offset += sizeof(*ack);
 
-                        Log(Log::Level::ALL) << idString << "Got Ack reply message, time: " << ack->time <<
+                        RELAY_LOG(Log::Level::ALL) << idString << "Got Ack reply message, time: " << ack->time <<
                             ", version: " << static_cast<uint32_t>(ack->version[0]) << "." <<
                         static_cast<uint32_t>(ack->version[1]) << "." <<
                         static_cast<uint32_t>(ack->version[2]) << "." <<
                         static_cast<uint32_t>(ack->version[3]);
-                        Log(Log::Level::ALL) << idString << "Handshake done";
+                        RELAY_LOG(Log::Level::ALL) << idString << "Handshake done";
 
                         state = State::HANDSHAKE_DONE;
                     }
@@ -578,13 +780,13 @@ namespace relay
             {
                 if (state == State::VERSION_SENT)
                 {
-                    if (data.size() - offset >= sizeof(uint8_t))
+                    if (bufferSize - offset >= sizeof(uint8_t))
                     {
                         // S0
-                        uint8_t version = *(data.data() + offset);
+                        uint8_t version = *(buffer + offset);
                         offset += sizeof(version);
 
-                        Log(Log::Level::ALL) << idString << "Got reply version " << static_cast<uint32_t>(version);
+                        RELAY_LOG(Log::Level::ALL) << idString << "Got reply version " << static_cast<uint32_t>(version);
 
                         if (version != 0x03)
                         {
@@ -602,13 +804,13 @@ namespace relay
                 }
                 else if (state == State::VERSION_RECEIVED)
                 {
-                    if (data.size() - offset >= sizeof(rtmp::Challenge))
+                    if (bufferSize - offset >= sizeof(rtmp::Challenge))
                     {
                         // S1
-                        rtmp::Challenge* challenge = reinterpret_cast<rtmp::Challenge*>(data.data() + offset);
+                        const rtmp::Challenge* challenge = reinterpret_cast<const rtmp::Challenge*>(buffer + offset);
                         offset += sizeof(*challenge);
 
-                        Log(Log::Level::ALL) << idString << "Got challenge reply message, time: " << challenge->time <<
+                        RELAY_LOG(Log::Level::ALL) << idString << "Got challenge reply message, time: " << challenge->time <<
                             ", version: " << static_cast<uint32_t>(challenge->version[0]) << "." <<
                         static_cast<uint32_t>(challenge->version[1]) << "." <<
                         static_cast<uint32_t>(challenge->version[2]) << "." <<
@@ -624,7 +826,7 @@ namespace relay
                                                      reinterpret_cast<uint8_t*>(&ack) + sizeof(ack));
                         socket.send(ackData);
 
-                        Log(Log::Level::ALL) << "[" << id << ", " << name << " " << applicationName << "/" << streamName << "] " << "Sending Ack message";
+                        RELAY_LOG(Log::Level::ALL) << "[" << id << ", " << name << " " << applicationName << "/" << streamName << "] " << "Sending Ack message";
 
                         state = State::ACK_SENT;
                     }
@@ -635,22 +837,23 @@ namespace relay
                 }
                 else if (state == State::ACK_SENT)
                 {
-                    if (data.size() - offset >= sizeof(rtmp::Ack))
+                    if (bufferSize - offset >= sizeof(rtmp::Ack))
                     {
                         // S2
-                        rtmp::Ack* ack = reinterpret_cast<rtmp::Ack*>(data.data() + offset);
+                        const rtmp::Ack* ack = reinterpret_cast<const rtmp::Ack*>(buffer + offset);
                         offset += sizeof(*ack);
 
-                        Log(Log::Level::ALL) << idString << "Got Ack reply message, time: " << ack->time <<
+                        RELAY_LOG(Log::Level::ALL) << idString << "Got Ack reply message, time: " << ack->time <<
                             ", version: " << static_cast<uint32_t>(ack->version[0]) << "." <<
                             static_cast<uint32_t>(ack->version[1]) << "." <<
                             static_cast<uint32_t>(ack->version[2]) << "." <<
                             static_cast<uint32_t>(ack->version[3]);
-                        Log(Log::Level::ALL) << idString << "Handshake done";
+                        RELAY_LOG(Log::Level::ALL) << idString << "Handshake done";
                         
                         state = State::HANDSHAKE_DONE;
+                        reconnectTimer.stop();
 
-                        Log(Log::Level::ALL) << idString << "Connecting to application " << applicationName;
+                        RELAY_LOG(Log::Level::ALL) << idString << "Connecting to application " << applicationName;
 
                         sendConnect();
                     }
@@ -662,34 +865,41 @@ namespace relay
             }
         }
 
-        if (offset > data.size())
+        if (offset > bufferSize)
         {
             if (socket.isReady())
             {
-                Log(Log::Level::ERR) << idString << "Reading outside of the buffer, buffer size: " << static_cast<uint32_t>(data.size()) << ", data size: " << offset;
+                Log(Log::Level::ERR) << idString << "Reading outside of the buffer, buffer size: " << bufferSize << ", data size: " << offset;
             }
 
             data.clear();
         }
         else
         {
-            data.erase(data.begin(), data.begin() + offset);
+            data.consume(offset - data.getOffset());
             
-            Log(Log::Level::ALL) << idString << "Remaining data " << data.size();
+            RELAY_LOG(Log::Level::ALL) << idString << "Remaining data " << data.getSize();
         }
     }
 
+    void Connection::handleWrite(Socket&)
+    {
+        completeFrames();
+
+        metrics.sentBytes.store(socket.getSentSize(), std::memory_order_relaxed);
+        metrics.sendQueueBytes.store(socket.getOutDataSize(), std::memory_order_relaxed);
+    }
+
     void Connection::handleClose(Socket&)
     {
-        Log(Log::Level::INFO) << idString << "Handle close connection at " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " disconnected";
+        RELAY_LOG(Log::Level::INFO) << idString << "Handle close connection at " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " disconnected";
 
         reset();
 
-        timeSincePing = 0.0f;
-        timeSinceConnect = 0.0f;
+        relay.cleanup();
     }
 
-    bool Connection::handlePacket(const rtmp::Packet& packet)
+    bool Connection::handlePacket(rtmp::Packet& packet)
     {
         switch (packet.messageType)
         {
@@ -704,7 +914,7 @@ namespace relay
                     return false;
                 }
 
-                Log(Log::Level::ALL) << idString << "Received SET_CHUNK_SIZE, parameter: " << inChunkSize;
+                RELAY_LOG(Log::Level::ALL) << idString << "Received SET_CHUNK_SIZE, parameter: " << inChunkSize;
 
                 if (type == Type::CLIENT)
                 {
@@ -716,7 +926,7 @@ namespace relay
 
             case rtmp::MessageType::ABORT:
             {
-                Log(Log::Level::ALL) << idString << "Received ABORT";
+                RELAY_LOG(Log::Level::ALL) << idString << "Received ABORT";
                 break;
             }
 
@@ -732,7 +942,7 @@ namespace relay
                     return false;
                 }
 
-                Log(Log::Level::ALL) << idString << "Received BYTES_READ, parameter: " << bytesRead;
+                RELAY_LOG(Log::Level::ALL) << idString << "Received BYTES_READ, parameter: " << bytesRead;
 
                 break;
             }
@@ -763,6 +973,7 @@ namespace relay
 
                 offset += ret;
 
+                if (RELAY_LOG_ENABLED(Log::Level::ALL))
                 {
                     Log log(Log::Level::ALL);
                     log << idString << "Received PING, type: ";
@@ -774,9 +985,7 @@ namespace relay
                         case rtmp::UserControlType::CLIENT_BUFFER_TIME: log << "CLIENT_BUFFER_TIME"; break;
                         case rtmp::UserControlType::RESET_STREAM: log << "RESET_STREAM"; break;
                         case rtmp::UserControlType::PING: log << "PING"; break;
-                        case rtmp::UserControlType::PONG: log << "PONG";
-                            timeSincePong = 0;
-                            break;
+                        case rtmp::UserControlType::PONG: log << "PONG"; break;
                     }
 
                     log << ", param: " << param;
@@ -786,6 +995,10 @@ namespace relay
                 {
                     sendUserControl(rtmp::UserControlType::PONG, packet.timestamp);
                 }
+                else if (userControlType == rtmp::UserControlType::PONG && pongTimer.isActive())
+                {
+                    pongTimer.start(2 * pingInterval, std::bind(&Connection::handlePongTimeout, this, std::placeholders::_1));
+                }
 
                 break;
             }
@@ -804,7 +1017,7 @@ namespace relay
 
                 offset += ret;
 
-                Log(Log::Level::ALL) << idString << "Received SERVER_BANDWIDTH, parameter: " << bandwidth;
+                RELAY_LOG(Log::Level::ALL) << idString << "Received SERVER_BANDWIDTH, parameter: " << bandwidth;
 
                 break;
             }
@@ -833,7 +1046,7 @@ namespace relay
 
                 offset += ret;
 
-                Log(Log::Level::ALL) << idString << "Received CLIENT_BANDWIDTH, parameter: " << bandwidth << ", type: " << bandwidthType;
+                RELAY_LOG(Log::Level::ALL) << idString << "Received CLIENT_BANDWIDTH, parameter: " << bandwidth << ", type: " << bandwidthType;
 
                 break;
             }
@@ -877,6 +1090,7 @@ namespace relay
 
                     offset += ret;
 
+                    if (RELAY_LOG_ENABLED(Log::Level::ALL))
                     {
                         Log log(Log::Level::ALL);
                         log << idString << "Received NOTIFY, command: ";
@@ -889,9 +1103,12 @@ namespace relay
                     {
                         offset += ret;
 
-                        Log log(Log::Level::ALL);
-                        log << idString << "Argument 1: ";
-                        argument1.dump(log);
+                        if (RELAY_LOG_ENABLED(Log::Level::ALL))
+                        {
+                            Log log(Log::Level::ALL);
+                            log << idString << "Argument 1: ";
+                            argument1.dump(log);
+                        }
                     }
 
                     amf::Node argument2;
@@ -900,9 +1117,12 @@ namespace relay
                     {
                         offset += ret;
 
-                        Log log(Log::Level::ALL);
-                        log << idString << "Argument 2: ";
-                        argument2.dump(log);
+                        if (RELAY_LOG_ENABLED(Log::Level::ALL))
+                        {
+                            Log log(Log::Level::ALL);
+                            log << idString << "Argument 2: ";
+                            argument2.dump(log);
+                        }
                     }
 
                     if (command.asString() == "@setDataFrame" &&
@@ -915,24 +1135,32 @@ namespace relay
                         if (metaData.hasElement("audiocodecid"))
                         {
                             if (metaData["audiocodecid"].isNumber())
-                                Log(Log::Level::ALL) << "Audio codec: " << getAudioCodec(static_cast<AudioCodec>(metaData["audiocodecid"].asUInt32()));
+                            {
+                                RELAY_LOG(Log::Level::ALL) << "Audio codec: " << getAudioCodec(static_cast<AudioCodec>(metaData["audiocodecid"].asUInt32()));
+                            }
                             else if (metaData["audiocodecid"].isString())
-                                Log(Log::Level::ALL) << "Audio codec: " << metaData["audiocodecid"].asString();
+                            {
+                                RELAY_LOG(Log::Level::ALL) << "Audio codec: " << metaData["audiocodecid"].asString();
+                            }
                         }
 
                         if (metaData.hasElement("videocodecid"))
                         {
                             if (metaData["videocodecid"].isNumber())
-                                Log(Log::Level::ALL) << "Video codec: " << getVideoCodec(static_cast<VideoCodec>(metaData["videocodecid"].asUInt32()));
+                            {
+                                RELAY_LOG(Log::Level::ALL) << "Video codec: " << getVideoCodec(static_cast<VideoCodec>(metaData["videocodecid"].asUInt32()));
+                            }
                             else if (metaData["videocodecid"].isString())
-                                Log(Log::Level::ALL) << "Video codec: " << metaData["videocodecid"].asString();
+                            {
+                                RELAY_LOG(Log::Level::ALL) << "Video codec: " << metaData["videocodecid"].asString();
+                            }
                         }
 
                         // forward notify packet
                         if (stream)
                         {
                             stream->sendMetaData(metaData);
-                            timeSinceLastData = 0;
+                            lastDataTime = std::chrono::steady_clock::now();
                         }
                         else
                         {
@@ -950,24 +1178,32 @@ namespace relay
                         if (metaData.hasElement("audiocodecid"))
                         {
                             if (metaData["audiocodecid"].isNumber())
-                                Log(Log::Level::ALL) << "Audio codec: " << getAudioCodec(static_cast<AudioCodec>(metaData["audiocodecid"].asUInt32()));
+                            {
+                                RELAY_LOG(Log::Level::ALL) << "Audio codec: " << getAudioCodec(static_cast<AudioCodec>(metaData["audiocodecid"].asUInt32()));
+                            }
                             else if (metaData["audiocodecid"].isString())
-                                Log(Log::Level::ALL) << "Audio codec: " << metaData["audiocodecid"].asString();
+                            {
+                                RELAY_LOG(Log::Level::ALL) << "Audio codec: " << metaData["audiocodecid"].asString();
+                            }
                         }
 
                         if (metaData.hasElement("videocodecid"))
                         {
                             if (metaData["videocodecid"].isNumber())
-                                Log(Log::Level::ALL) << "Video codec: " << getVideoCodec(static_cast<VideoCodec>(metaData["videocodecid"].asUInt32()));
+                            {
+                                RELAY_LOG(Log::Level::ALL) << "Video codec: " << getVideoCodec(static_cast<VideoCodec>(metaData["videocodecid"].asUInt32()));
+                            }
                             else if (metaData["videocodecid"].isString())
-                                Log(Log::Level::ALL) << "Video codec: " << metaData["videocodecid"].asString();
+                            {
+                                RELAY_LOG(Log::Level::ALL) << "Video codec: " << metaData["videocodecid"].asString();
+                            }
                         }
 
                         // forward notify packet
                         if (stream)
                         {
                             stream->sendMetaData(metaData);
-                            timeSinceLastData = 0;
+                            lastDataTime = std::chrono::steady_clock::now();
                         }
                         else
                         {
@@ -981,7 +1217,7 @@ namespace relay
                         if (stream)
                         {
                             stream->sendTextData(packet.timestamp, argument1);
-                            timeSinceLastData = 0;
+                            lastDataTime = std::chrono::steady_clock::now();
                         }
                         else
                         {
@@ -1005,14 +1241,18 @@ namespace relay
                 // only input can receive audio packets
                 if (direction == Direction::INPUT)
                 {
+                    if (RELAY_LOG_ENABLED(Log::Level::ALL))
                     {
                         Log log(Log::Level::ALL);
                         log << idString << "Received AUDIO_PACKET";
                         if (isCodecHeader(packet.data)) log << "(header)";
                     }
 
+                    Trace::record(Trace::Event::FRAME_RECEIVED, id, stream ? stream->getId() : 0,
+                                  packet.timestamp, 0, packet.data.size(), static_cast<uint8_t>(packet.messageType));
+
                     currentAudioBytes += packet.data.size();
-                    timeSinceLastData = 0;
+                    lastDataTime = std::chrono::steady_clock::now();
 
                     if (isCodecHeader(packet.data))
                     {
@@ -1020,11 +1260,11 @@ namespace relay
                         AudioCodec codec = static_cast<AudioCodec>((format & 0xf0) >> 4);
                         uint32_t channels = (format & 0x01) + 1;
                         uint32_t sampleSize = (format & 0x02) ? 2 : 1;
-                        Log(Log::Level::ALL) << "Codec: " << getAudioCodec(codec) << ", channels: " << channels << ", sampleSize: " << sampleSize * 8;
+                        RELAY_LOG(Log::Level::ALL) << "Codec: " << getAudioCodec(codec) << ", channels: " << channels << ", sampleSize: " << sampleSize * 8;
 
                         if (stream)
                         {
-                            stream->sendAudioHeader(packet.data);
+                            stream->sendAudioHeader(Buffer(std::move(packet.data)));
                         }
                         else
                         {
@@ -1038,7 +1278,7 @@ namespace relay
                         // forward audio packet
                         if (stream)
                         {
-                            stream->sendAudioFrame(packet.timestamp, packet.data);
+                            stream->sendAudioFrame(packet.timestamp, Buffer(std::move(packet.data)), std::chrono::steady_clock::now());
                         }
                         else
                         {
@@ -1064,6 +1304,7 @@ namespace relay
                 {
                     VideoFrameType frameType = getVideoFrameType(packet.data);
 
+                    if (RELAY_LOG_ENABLED(Log::Level::ALL))
                     {
                         Log log(Log::Level::ALL);
                         log << idString << "Received VIDEO_PACKET";
@@ -1084,19 +1325,22 @@ namespace relay
                         }
                     }
 
+                    Trace::record(Trace::Event::FRAME_RECEIVED, id, stream ? stream->getId() : 0,
+                                  packet.timestamp, 0, packet.data.size(), static_cast<uint8_t>(packet.messageType));
+
                     currentVideoBytes += packet.data.size();
-                    timeSinceLastData = 0;
+                    lastDataTime = std::chrono::steady_clock::now();
 
                     if (isCodecHeader(packet.data))
                     {
                         uint8_t format = packet.data[0];
                         VideoCodec codec = static_cast<VideoCodec>(format & 0x0f);
-                        Log(Log::Level::ALL) << "Codec: " << getVideoCodec(codec);
+                        RELAY_LOG(Log::Level::ALL) << "Codec: " << getVideoCodec(codec);
 
                         if (stream)
                         {
                             // do nothing if frameType is VideoFrameType::VIDEO_INFO
-                            if (frameType == VideoFrameType::KEY) stream->sendVideoHeader(packet.data);
+                            if (frameType == VideoFrameType::KEY) stream->sendVideoHeader(Buffer(std::move(packet.data)));
                         }
                         else
                         {
@@ -1110,7 +1354,7 @@ namespace relay
                         // forward video packet
                         if (stream)
                         {
-                            stream->sendVideoFrame(packet.timestamp, packet.data, frameType);
+                            stream->sendVideoFrame(packet.timestamp, Buffer(std::move(packet.data)), frameType, std::chrono::steady_clock::now());
                         }
                         else
                         {
@@ -1165,6 +1409,7 @@ namespace relay
 
                 offset += ret;
 
+                if (RELAY_LOG_ENABLED(Log::Level::ALL))
                 {
                     Log log(Log::Level::ALL);
                     log << idString << "Received INVOKE, command: ";
@@ -1182,6 +1427,7 @@ namespace relay
 
                 offset += ret;
 
+                if (RELAY_LOG_ENABLED(Log::Level::ALL))
                 {
                     Log log(Log::Level::ALL);
                     log << idString << "Transaction ID: ";
@@ -1194,9 +1440,12 @@ namespace relay
                 {
                     offset += ret;
 
-                    Log log(Log::Level::ALL);
-                    log << idString << "Argument 1: ";
-                    argument1.dump(log);
+                    if (RELAY_LOG_ENABLED(Log::Level::ALL))
+                    {
+                        Log log(Log::Level::ALL);
+                        log << idString << "Argument 1: ";
+                        argument1.dump(log);
+                    }
                 }
 
                 if (command.asString() == "connect")
@@ -1218,19 +1467,23 @@ namespace relay
                         sendOnBWDone();
 
                         connected = true;
+                        startPing();
 
                         updateIdString();
-                        Log(Log::Level::INFO) << idString << "Input from " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " sent connect, application: \"" << argument1["app"].asString() << "\"";
+                        RELAY_LOG(Log::Level::INFO) << idString << "Input from " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " sent connect, application: \"" << argument1["app"].asString() << "\"";
 
 #ifdef DEBUG
-                        Log log(Log::Level::ALL);
-                        log << "Connect argument: ";
-                        argument1.dump(log);
+                        if (RELAY_LOG_ENABLED(Log::Level::ALL))
+                        {
+                            Log log(Log::Level::ALL);
+                            log << "Connect argument: ";
+                            argument1.dump(log);
+                        }
 #endif
                     }
                     else
                     {
-                        Log(Log::Level::INFO) << idString << "Invalid message (\"connect\") received, disconnecting";
+                        RELAY_LOG(Log::Level::INFO) << idString << "Invalid message (\"connect\") received, disconnecting";
                         close();
                         return false;
                     }
@@ -1243,7 +1496,7 @@ namespace relay
                     }
                     else
                     {
-                        Log(Log::Level::INFO) << idString << "Invalid message (\"onBWDone\"), disconnecting";
+                        RELAY_LOG(Log::Level::INFO) << idString << "Invalid message (\"onBWDone\"), disconnecting";
                         close();
                         return false;
                     }
@@ -1256,7 +1509,7 @@ namespace relay
                     }
                     else
                     {
-                        Log(Log::Level::INFO) << idString << "Invalid message (\"_checkbw\"), disconnecting";
+                        RELAY_LOG(Log::Level::INFO) << idString << "Invalid message (\"_checkbw\"), disconnecting";
                         close();
                         return false;
                     }
@@ -1269,7 +1522,7 @@ namespace relay
                     }
                     else
                     {
-                        Log(Log::Level::INFO) << idString << "Invalid message (\"createStream\"), disconnecting";
+                        RELAY_LOG(Log::Level::INFO) << idString << "Invalid message (\"createStream\"), disconnecting";
                         close();
                         return false;
                     }
@@ -1282,7 +1535,7 @@ namespace relay
                     }
                     else
                     {
-                        Log(Log::Level::INFO) << idString << "Invalid message (\"releaseStream\"), disconnecting";
+                        RELAY_LOG(Log::Level::INFO) << idString << "Invalid message (\"releaseStream\"), disconnecting";
                         close();
                         return false;
                     }
@@ -1298,7 +1551,7 @@ namespace relay
                     }
                     else
                     {
-                        Log(Log::Level::INFO) << idString << "Invalid message (\"deleteStream\"), disconnecting";
+                        RELAY_LOG(Log::Level::INFO) << idString << "Invalid message (\"deleteStream\"), disconnecting";
                         close();
                         return false;
                     }
@@ -1324,7 +1577,7 @@ namespace relay
                 {
                     if (direction == Direction::INPUT)
                     {
-                        Log(Log::Level::INFO) << idString << "Input from " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " unpublished stream \"" << streamName << "\"";
+                        RELAY_LOG(Log::Level::INFO) << idString << "Input from " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " unpublished stream \"" << streamName << "\"";
 
                         sendOnFCUnpublish();
 
@@ -1382,25 +1635,32 @@ namespace relay
                         {
                             offset += ret;
 
-                            Log log(Log::Level::ALL);
-                            log << idString << "Argument 2: ";
-                            argument2.dump(log);
+                            if (RELAY_LOG_ENABLED(Log::Level::ALL))
+                            {
+                                Log log(Log::Level::ALL);
+                                log << idString << "Argument 2: ";
+                                argument2.dump(log);
+                            }
                         }
 
                         streamName = argument2.asString();
                         updateIdString();
 
+                        if (startHandover(packet)) return true;
+
                         std::vector<std::pair<Server*, const Endpoint*>> endpoints = relay.getEndpoints(std::make_pair(socket.getLocalIPAddress(), socket.getLocalPort()), direction, applicationName, streamName);
 
                         if (!endpoints.empty())
                         {
                             Server* server = endpoints.front().first;
                             endpoint = endpoints.front().second;
+                            socket.setOptions(endpoint->socketOptions);
 
                             sendUserControl(rtmp::UserControlType::CLEAR_STREAM);
                             sendPublishStatus(transactionId.asDouble());
 
                             pingInterval = endpoint->pingInterval;
+                            startPing();
 
                             Stream* newStream = server->findStream(applicationName, streamName);
                             if (!newStream)
@@ -1414,7 +1674,7 @@ namespace relay
                                 return false;
                             }
 
-                            Log(Log::Level::INFO) << idString << "Input from " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " published stream \"" << streamName << "\"";
+                            RELAY_LOG(Log::Level::INFO) << idString << "Input from " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " published stream \"" << streamName << "\"";
 
                             stream = newStream;
                             streaming = true;
@@ -1445,7 +1705,7 @@ namespace relay
                         return false;
                     }
 
-                    Log(Log::Level::INFO) << idString << "Input from " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " unpublished stream \"" << streamName << "\"";
+                    RELAY_LOG(Log::Level::INFO) << idString << "Input from " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " unpublished stream \"" << streamName << "\"";
 
                     sendUnublishStatus(transactionId.asDouble());
                     close();
@@ -1468,16 +1728,21 @@ namespace relay
                     {
                         offset += ret;
 
-                        Log log(Log::Level::ALL);
-                        log << idString << "Argument 2: ";
-                        argument2.dump(log);
+                        if (RELAY_LOG_ENABLED(Log::Level::ALL))
+                        {
+                            Log log(Log::Level::ALL);
+                            log << idString << "Argument 2: ";
+                            argument2.dump(log);
+                        }
                     }
 
-                    Log(Log::Level::INFO) << idString << "Input from " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " sent play, stream: \"" << argument2.asString() << "\"";
+                    RELAY_LOG(Log::Level::INFO) << idString << "Input from " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " sent play, stream: \"" << argument2.asString() << "\"";
 
                     streamName = argument2.asString();
                     updateIdString();
 
+                    if (startHandover(packet)) return true;
+
                     std::vector<std::pair<Server*, const Endpoint*>> endpoints = relay.getEndpoints(std::make_pair(socket.getLocalIPAddress(), socket.getLocalPort()), direction, applicationName, streamName);
 
                     if (endpoints.empty())
@@ -1490,6 +1755,8 @@ namespace relay
 
                     Server* server = endpoints.front().first;
                     endpoint = endpoints.front().second;
+                    socket.setOptions(endpoint->socketOptions);
+                    socket.setZeroCopyThreshold(endpoint->zeroCopyThreshold);
 
                     sendUserControl(rtmp::UserControlType::CLEAR_STREAM);
                     sendPlayStatus(transactionId.asDouble());
@@ -1532,9 +1799,12 @@ namespace relay
                     {
                         offset += ret;
 
-                        Log log(Log::Level::ALL);
-                        log << idString << "Argument 2: ";
-                        argument2.dump(log);
+                        if (RELAY_LOG_ENABLED(Log::Level::ALL))
+                        {
+                            Log log(Log::Level::ALL);
+                            log << idString << "Argument 2: ";
+                            argument2.dump(log);
+                        }
                     }
 
                     // TODO: paarbaudiit - izskataas nepareizi
@@ -1592,13 +1862,13 @@ namespace relay
 
                     if (i != invokes.end())
                     {
-                        Log(Log::Level::ALL) << idString << i->second << " error";
+                        RELAY_LOG(Log::Level::ALL) << idString << i->second << " error";
 
                         invokes.erase(i);
                     }
                     else
                     {
-                        Log(Log::Level::ALL) << idString << i->second << "Invalid _error received";
+                        RELAY_LOG(Log::Level::ALL) << idString << i->second << "Invalid _error received";
                     }
                 }
                 else if (command.asString() == "_result")
@@ -1607,7 +1877,7 @@ namespace relay
 
                     if (i != invokes.end())
                     {
-                        Log(Log::Level::ALL) << idString << i->second << " result";
+                        RELAY_LOG(Log::Level::ALL) << idString << i->second << " result";
 
                         if (i->second == "connect")
                         {
@@ -1617,14 +1887,14 @@ namespace relay
                             {
                                 if (direction == Direction::OUTPUT)
                                 {
-                                    Log(Log::Level::ALL) << idString << "Publishing stream " << streamName;
+                                    RELAY_LOG(Log::Level::ALL) << idString << "Publishing stream " << streamName;
 
                                     sendReleaseStream();
                                     sendFCPublish();
                                 }
                                 else if (direction == Direction::INPUT)
                                 {
-                                    Log(Log::Level::ALL) << idString << "Subscribing to stream " << streamName;
+                                    RELAY_LOG(Log::Level::ALL) << idString << "Subscribing to stream " << streamName;
 
                                     sendFCSubscribe();
                                 }
@@ -1646,9 +1916,12 @@ namespace relay
                             {
                                 offset += ret;
 
-                                Log log(Log::Level::ALL);
-                                log << idString << "Argument 2: ";
-                                argument2.dump(log);
+                                if (RELAY_LOG_ENABLED(Log::Level::ALL))
+                                {
+                                    Log log(Log::Level::ALL);
+                                    log << idString << "Argument 2: ";
+                                    argument2.dump(log);
+                                }
                             }
 
                             streamId = static_cast<uint32_t>(argument2.asDouble());
@@ -1664,7 +1937,7 @@ namespace relay
                                 sendPublish();
                             }
 
-                            Log(Log::Level::ALL) << idString << "Created stream " << streamId;
+                            RELAY_LOG(Log::Level::ALL) << idString << "Created stream " << streamId;
                         }
                         else if (i->second == "deleteStream")
                         {
@@ -1674,7 +1947,7 @@ namespace relay
                     }
                     else
                     {
-                        Log(Log::Level::ALL) << idString << "Invalid _result received, transaction ID: " << static_cast<uint32_t>(transactionId.asDouble());
+                        RELAY_LOG(Log::Level::ALL) << idString << "Invalid _result received, transaction ID: " << static_cast<uint32_t>(transactionId.asDouble());
                     }
                 }
                 break;
@@ -1683,13 +1956,13 @@ namespace relay
             case rtmp::MessageType::AMF0_SHARED_OBJECT:
             case rtmp::MessageType::AMF3_SHARED_OBJECT:
             {
-                Log(Log::Level::ALL) << idString << "Received shared object";
+                RELAY_LOG(Log::Level::ALL) << idString << "Received shared object";
                 break;
             }
 
             case rtmp::MessageType::AGGREGATE:
             {
-                Log(Log::Level::ALL) << idString << "Received aggregated messages";
+                RELAY_LOG(Log::Level::ALL) << idString << "Received aggregated messages";
                 break;
             }
 
@@ -1781,9 +2054,9 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending SERVER_BANDWIDTH";
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending SERVER_BANDWIDTH";
 
-        return socket.send(buffer);
+        return socket.send(std::move(buffer));
     }
 
     bool Connection::sendClientBandwidth()
@@ -1799,9 +2072,9 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending CLIENT_BANDWIDTH";
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending CLIENT_BANDWIDTH";
 
-        return socket.send(buffer);
+        return socket.send(std::move(buffer));
     }
 
     bool Connection::sendUserControl(rtmp::UserControlType userControlType, uint64_t timestamp, uint32_t parameter1, uint32_t parameter2)
@@ -1818,23 +2091,26 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log log(Log::Level::ALL);
-        log << idString << "Sending USER_CONTROL of type: ";
-
-        switch (userControlType)
+        if (RELAY_LOG_ENABLED(Log::Level::ALL))
         {
-            case rtmp::UserControlType::CLEAR_STREAM: log << "CLEAR_STREAM"; break;
-            case rtmp::UserControlType::CLEAR_BUFFER: log << "CLEAR_BUFFER"; break;
-            case rtmp::UserControlType::CLIENT_BUFFER_TIME: log << "CLIENT_BUFFER_TIME"; break;
-            case rtmp::UserControlType::RESET_STREAM: log << "RESET_STREAM"; break;
-            case rtmp::UserControlType::PING: log << "PING"; break;
-            case rtmp::UserControlType::PONG: log << "PONG"; break;
-        }
+            Log log(Log::Level::ALL);
+            log << idString << "Sending USER_CONTROL of type: ";
 
-        log << ", parameter 1: " << parameter1;
-        if (parameter2 != 0) log << ", parameter 2: " << parameter2;
+            switch (userControlType)
+            {
+                case rtmp::UserControlType::CLEAR_STREAM: log << "CLEAR_STREAM"; break;
+                case rtmp::UserControlType::CLEAR_BUFFER: log << "CLEAR_BUFFER"; break;
+                case rtmp::UserControlType::CLIENT_BUFFER_TIME: log << "CLIENT_BUFFER_TIME"; break;
+                case rtmp::UserControlType::RESET_STREAM: log << "RESET_STREAM"; break;
+                case rtmp::UserControlType::PING: log << "PING"; break;
+                case rtmp::UserControlType::PONG: log << "PONG"; break;
+            }
+
+            log << ", parameter 1: " << parameter1;
+            if (parameter2 != 0) log << ", parameter 2: " << parameter2;
+        }
 
-        return socket.send(buffer);
+        return socket.send(std::move(buffer));
     }
 
     bool Connection::sendSetChunkSize()
@@ -1849,9 +2125,9 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending SET_CHUNK_SIZE";
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending SET_CHUNK_SIZE";
         
-        return socket.send(buffer);
+        return socket.send(std::move(buffer));
     }
 
     bool Connection::sendOnBWDone()
@@ -1885,7 +2161,7 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
         if (!socket.send(buffer)) return false;
 
@@ -1922,7 +2198,7 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
         if (!socket.send(buffer)) return false;
 
@@ -1959,9 +2235,9 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
         
-        return socket.send(buffer);
+        return socket.send(std::move(buffer));
     }
 
     bool Connection::sendCreateStream()
@@ -1992,7 +2268,7 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
         if (!socket.send(buffer)) return false;
 
@@ -2038,9 +2314,9 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
-        return socket.send(buffer);
+        return socket.send(std::move(buffer));
     }
 
     bool Connection::sendReleaseStream()
@@ -2074,7 +2350,7 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
         if (!socket.send(buffer)) return false;
 
@@ -2111,9 +2387,9 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
-        return socket.send(buffer);
+        return socket.send(std::move(buffer));
     }
 
     bool Connection::sendDeleteStream()
@@ -2147,7 +2423,7 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
         
         if (!socket.send(buffer)) return false;
         
@@ -2192,12 +2468,12 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
         if (!socket.send(buffer)) return false;
 
         invokes[invokeId] = commandName.asString();
-        timeSinceLastData = 0;
+        lastDataTime = std::chrono::steady_clock::now();
 
         return true;
     }
@@ -2240,10 +2516,10 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
-        timeSinceLastData = 0;
-        return socket.send(buffer);
+        lastDataTime = std::chrono::steady_clock::now();
+        return socket.send(std::move(buffer));
     }
 
     bool Connection::sendFCPublish()
@@ -2277,7 +2553,7 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
         if (!socket.send(buffer)) return false;
 
@@ -2308,9 +2584,9 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
-        return socket.send(buffer);
+        return socket.send(std::move(buffer));
     }
 
     bool Connection::sendFCUnpublish()
@@ -2344,7 +2620,7 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
         if (!socket.send(buffer)) return false;
 
@@ -2377,9 +2653,9 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
-        return socket.send(buffer);
+        return socket.send(std::move(buffer));
     }
 
     bool Connection::sendFCSubscribe()
@@ -2413,7 +2689,7 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
         if (!socket.send(buffer)) return false;
 
@@ -2454,9 +2730,9 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
-        return socket.send(buffer);
+        return socket.send(std::move(buffer));
     }
 
     bool Connection::sendFCUnsubscribe()
@@ -2490,7 +2766,7 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
         if (!socket.send(buffer)) return false;
 
@@ -2521,9 +2797,9 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
-        return socket.send(buffer);
+        return socket.send(std::move(buffer));
     }
 
     bool Connection::sendPublish()
@@ -2561,15 +2837,15 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
         if (!socket.send(buffer)) return false;
 
         invokes[invokeId] = commandName.asString();
 
-        Log(Log::Level::INFO) << idString << "Published stream \"" << streamName << "\" (ID: " << streamId << ") to " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort();
+        RELAY_LOG(Log::Level::INFO) << idString << "Published stream \"" << streamName << "\" (ID: " << streamId << ") to " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort();
 
-        timeSinceLastData = 0;
+        lastDataTime = std::chrono::steady_clock::now();
         return true;
     }
 
@@ -2609,9 +2885,9 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
         
-        return socket.send(buffer);
+        return socket.send(std::move(buffer));
     }
 
     bool Connection::sendUnublishStatus(double transactionId)
@@ -2650,37 +2926,57 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
         
-        return socket.send(buffer);
+        return socket.send(std::move(buffer));
     }
 
-    bool Connection::sendAudioHeader(const std::vector<uint8_t>& headerData)
+    bool Connection::sendAudioHeader(const Buffer& headerData)
     {
         if (state != State::HANDSHAKE_DONE) return false;
 
         return sendAudioData(0, headerData);
     }
 
-    bool Connection::sendVideoHeader(const std::vector<uint8_t>& headerData)
+    bool Connection::sendVideoHeader(const Buffer& headerData)
     {
         if (state != State::HANDSHAKE_DONE) return false;
 
-        timeSinceLastData = 0;
+        lastDataTime = std::chrono::steady_clock::now();
         return sendVideoData(0, headerData);
 
         // TODO: send video info
     }
 
-    bool Connection::sendAudioFrame(uint64_t timestamp, const std::vector<uint8_t>& frameData)
+    bool Connection::sendAudioFrame(uint64_t timestamp, const Buffer& frameData, std::chrono::steady_clock::time_point ingestTime)
     {
         if (!streaming) return false;
 
-        timeSinceLastData = 0;
-        return sendAudioData(timestamp, frameData);
+        if (!endpoint) return false;
+
+        // audio is dropped last, only when the queue is twice over the limit
+        if (endpoint->audioStream && getSendQueueLoad() >= 2.0f)
+        {
+            ++droppedAudioFrames;
+            metrics.droppedFrames.fetch_add(1, std::memory_order_relaxed);
+            traceFrame(Trace::Event::FRAME_DROPPED, timestamp, frameData, rtmp::MessageType::AUDIO_PACKET);
+            return true;
+        }
+
+        lastDataTime = std::chrono::steady_clock::now();
+
+        if (!sendAudioData(timestamp, frameData)) return false;
+
+        if (endpoint->audioStream)
+        {
+            queueFrame(timestamp, ingestTime);
+            traceFrame(Trace::Event::FRAME_QUEUED, timestamp, frameData, rtmp::MessageType::AUDIO_PACKET);
+        }
+
+        return true;
     }
 
-    bool Connection::sendVideoFrame(uint64_t timestamp, const std::vector<uint8_t>& frameData, VideoFrameType frameType)
+    bool Connection::sendVideoFrame(uint64_t timestamp, const Buffer& frameData, VideoFrameType frameType, std::chrono::steady_clock::time_point ingestTime)
     {
         if (!streaming) return false;
 
@@ -2689,14 +2985,101 @@ namespace relay
         if (endpoint->videoStream &&
             (videoFrameSent || frameType == VideoFrameType::KEY))
         {
+            float load = getSendQueueLoad();
+
+            // disposable frames go first, other frames (and the frames that depend on them) when over the limit
+            if ((frameType == VideoFrameType::DISPOSABLE && load >= 0.5f) || load >= 1.0f)
+            {
+                ++droppedVideoFrames;
+                metrics.droppedFrames.fetch_add(1, std::memory_order_relaxed);
+                traceFrame(Trace::Event::FRAME_DROPPED, timestamp, frameData, rtmp::MessageType::VIDEO_PACKET);
+
+                if (frameType != VideoFrameType::DISPOSABLE)
+                {
+                    videoFrameSent = false;
+                    videoFrameDropped = true;
+                }
+
+                return true;
+            }
+
             videoFrameSent = true;
-            timeSinceLastData = 0;
-            return sendVideoData(timestamp, frameData);
+            videoFrameDropped = false;
+            lastDataTime = std::chrono::steady_clock::now();
+
+            if (!sendVideoData(timestamp, frameData)) return false;
+
+            queueFrame(timestamp, ingestTime);
+            traceFrame(Trace::Event::FRAME_QUEUED, timestamp, frameData, rtmp::MessageType::VIDEO_PACKET);
+        }
+        else if (videoFrameDropped)
+        {
+            ++droppedVideoFrames;
+            metrics.droppedFrames.fetch_add(1, std::memory_order_relaxed);
+            traceFrame(Trace::Event::FRAME_DROPPED, timestamp, frameData, rtmp::MessageType::VIDEO_PACKET);
         }
 
         return true;
     }
 
+    float Connection::getSendQueueLoad()
+    {
+        if (!endpoint) return 0.0f;
+
+        completeFrames();
+
+        float load = 0.0f;
+
+        if (endpoint->sendQueueSize > 0)
+        {
+            load = static_cast<float>(socket.getOutDataSize()) / endpoint->sendQueueSize;
+        }
+
+        if (endpoint->sendQueueDuration > 0 && !queuedFrames.empty() &&
+            queuedFrames.back().timestamp > queuedFrames.front().timestamp)
+        {
+            uint64_t duration = queuedFrames.back().timestamp - queuedFrames.front().timestamp;
+            load = std::max(load, static_cast<float>(duration) / endpoint->sendQueueDuration);
+        }
+
+        return load;
+    }
+
+    void Connection::queueFrame(uint64_t timestamp, std::chrono::steady_clock::time_point ingestTime)
+    {
+        QueuedFrame frame;
+        frame.position = socket.getSentSize() + socket.getOutDataSize();
+        frame.timestamp = timestamp;
+        frame.ingestTime = ingestTime;
+        queuedFrames.push_back(frame);
+
+        metrics.sendQueueBytes.store(socket.getOutDataSize(), std::memory_order_relaxed);
+    }
+
+    void Connection::completeFrames()
+    {
+        if (queuedFrames.empty()) return;
+
+        uint64_t sentSize = socket.getSentSize();
+        auto now = std::chrono::steady_clock::now();
+
+        while (!queuedFrames.empty() && queuedFrames.front().position <= sentSize)
+        {
+            uint64_t latency = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(now - queuedFrames.front().ingestTime).count());
+
+            latencyHistogram.record(latency);
+            if (stream) stream->getLatencyHistogram().record(latency);
+
+            queuedFrames.pop_front();
+        }
+    }
+
+    void Connection::traceFrame(Trace::Event event, uint64_t timestamp, const Buffer& frameData, rtmp::MessageType messageType)
+    {
+        Trace::record(event, id, stream ? stream->getId() : 0, timestamp,
+                      socket.getSentSize() + socket.getOutDataSize(), frameData.getSize(), static_cast<uint8_t>(messageType));
+    }
+
     bool Connection::sendMetaData(const amf::Node& newMetaData)
     {
         if (state != State::HANDSHAKE_DONE) return false;
@@ -2756,14 +3139,15 @@ namespace relay
             std::vector<uint8_t> buffer;
             packet.encode(buffer, outChunkSize, sentPackets);
 
+            if (RELAY_LOG_ENABLED(Log::Level::ALL))
             {
                 Log log(Log::Level::ALL);
                 log << idString << "Sending meta data " << commandName.asString() << ": ";
                 argument2.dump(log);
             }
 
-            timeSinceLastData = 0;
-            return socket.send(buffer);
+            lastDataTime = std::chrono::steady_clock::now();
+            return socket.send(std::move(buffer));
         }
 
         return true;
@@ -2799,14 +3183,15 @@ namespace relay
             std::vector<uint8_t> buffer;
             packet.encode(buffer, outChunkSize, sentPackets);
 
+            if (RELAY_LOG_ENABLED(Log::Level::ALL))
             {
                 Log log(Log::Level::ALL);
                 log << idString << "Sending text data: ";
                 argument1.dump(log);
             }
 
-            timeSinceLastData = 0;
-            return socket.send(buffer);
+            lastDataTime = std::chrono::steady_clock::now();
+            return socket.send(std::move(buffer));
         }
 
         return true;
@@ -2843,9 +3228,9 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
         
-        return socket.send(buffer);
+        return socket.send(std::move(buffer));
     }
 
     bool Connection::sendGetStreamLengthResult(double transactionId)
@@ -2879,9 +3264,9 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
         
-        return socket.send(buffer);
+        return socket.send(std::move(buffer));
     }
 
     bool Connection::sendPlay()
@@ -2916,10 +3301,10 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
-        timeSinceLastData = 0;
-        return socket.send(buffer);
+        lastDataTime = std::chrono::steady_clock::now();
+        return socket.send(std::move(buffer));
     }
 
     bool Connection::sendPlayStatus(double transactionId)
@@ -2958,9 +3343,9 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
-        return socket.send(buffer);
+        return socket.send(std::move(buffer));
     }
 
     bool Connection::sendStop()
@@ -2994,9 +3379,9 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
-        return socket.send(buffer);
+        return socket.send(std::move(buffer));
     }
 
     bool Connection::sendStopStatus(double transactionId)
@@ -3035,12 +3420,12 @@ namespace relay
         std::vector<uint8_t> buffer;
         packet.encode(buffer, outChunkSize, sentPackets);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
         
-        return socket.send(buffer);
+        return socket.send(std::move(buffer));
     }
 
-    bool Connection::sendAudioData(uint64_t timestamp, const std::vector<uint8_t>& audioData)
+    bool Connection::sendAudioData(uint64_t timestamp, const Buffer& audioData)
     {
         if (!endpoint || !streaming) return false;
 
@@ -3052,20 +3437,15 @@ namespace relay
             packet.timestamp = timestamp;
             packet.messageType = rtmp::MessageType::AUDIO_PACKET;
 
-            packet.data = audioData;
+            RELAY_LOG(Log::Level::ALL) << idString << "Sending audio packet";
 
-            std::vector<uint8_t> buffer;
-            packet.encode(buffer, outChunkSize, sentPackets);
-
-            Log(Log::Level::ALL) << idString << "Sending audio packet";
-
-            return socket.send(buffer);
+            return sendMediaPacket(packet, audioData);
         }
 
         return true;
     }
 
-    bool Connection::sendVideoData(uint64_t timestamp, const std::vector<uint8_t>& videoData)
+    bool Connection::sendVideoData(uint64_t timestamp, const Buffer& videoData)
     {
         if (!endpoint || !streaming) return false;
 
@@ -3077,19 +3457,40 @@ namespace relay
             packet.timestamp = timestamp;
             packet.messageType = rtmp::MessageType::VIDEO_PACKET;
 
-            packet.data = videoData;
-
-            std::vector<uint8_t> buffer;
-            packet.encode(buffer, outChunkSize, sentPackets);
+            RELAY_LOG(Log::Level::ALL) << idString << "Sending video packet";
 
-            Log(Log::Level::ALL) << idString << "Sending video packet";
-            
-            return socket.send(buffer);
+            return sendMediaPacket(packet, videoData);
         }
 
         return true;
     }
 
+    bool Connection::sendMediaPacket(const rtmp::Packet& packet, const Buffer& payload)
+    {
+        if (payload.isEmpty()) return true;
+
+        std::vector<uint8_t> firstHeader;
+        std::vector<uint8_t> nextHeader;
+
+        if (!packet.encodeHeaders(firstHeader, nextHeader, static_cast<uint32_t>(payload.getSize()), sentPackets))
+        {
+            return false;
+        }
+
+        // only the first header belongs to this connection, the rest is shared with the outputs that use the same chunking
+        ChunkCache localChunkCache;
+        ChunkCache& chunkCache = stream ? stream->getChunkCache() : localChunkCache;
+        Buffer chunks = chunkCache.getChunks(payload, outChunkSize, nextHeader);
+
+        Trace::record(Trace::Event::CHUNKS_ENCODED, id, stream ? stream->getId() : 0, packet.timestamp,
+                      outChunkSize, chunks.getSize(), static_cast<uint8_t>(packet.messageType));
+
+        metrics.sentMediaMessages.fetch_add(1, std::memory_order_relaxed);
+
+        return socket.send(std::move(firstHeader)) &&
+            socket.send(chunks, 0, chunks.getSize());
+    }
+
     bool Connection::isDependable()
     {
         return (type == Type::HOST) || (direction == Direction::INPUT && (endpoint ? endpoint->isNameKnown() : false));
@@ -4,9 +4,16 @@
 
 #pragma once
 
+#include <chrono>
+#include <deque>
 #include <map>
 #include <set>
+#include "ByteQueue.hpp"
+#include "LatencyHistogram.hpp"
+#include "Metrics.hpp"
 #include "Socket.hpp"
+#include "Timer.hpp"
+#include "Trace.hpp"
 #include "RTMP.hpp"
 #include "Amf.hpp"
 #include "Status.hpp"
@@ -46,11 +53,43 @@ namespace relay
             HANDSHAKE_DONE = 4
         };
 
+        // state of a host connection that is moved to the worker that owns its stream
+        struct Handover
+        {
+            uint64_t id = 0;
+            socket_t socketFd = INVALID_SOCKET;
+            uint32_t localIPAddress = 0;
+            uint16_t localPort = 0;
+            uint32_t remoteIPAddress = 0;
+            uint16_t remotePort = 0;
+            std::vector<uint8_t> outData;
+            std::vector<uint8_t> data;
+            rtmp::Packet packet; // publish or play, handled again by the new owner
+
+            State state = State::UNINITIALIZED;
+            uint32_t inChunkSize = 128;
+            uint32_t outChunkSize = 128;
+            uint32_t serverBandwidth = 2500000;
+            rtmp::ChunkStreams receivedPackets;
+            rtmp::ChunkStreams sentPackets;
+            uint32_t invokeId = 0;
+            std::map<uint32_t, std::string> invokes;
+            uint32_t streamId = 0;
+
+            Direction direction = Direction::NONE;
+            std::string applicationName;
+            std::string streamName;
+            bool connected = false;
+            amf::Version amfVersion = amf::Version::AMF0;
+        };
+
         Connection(Relay& aRelay,
                    Socket& client);
         Connection(Relay& aRelay,
                    Stream& aStream,
                    const Endpoint& aEndpoint);
+        Connection(Relay& aRelay,
+                   Handover& handover);
 
         Connection(const Connection&) = delete;
         Connection(Connection&&) = delete;
@@ -68,12 +107,11 @@ namespace relay
         Direction getDirection() const { return direction; }
         const std::string& getApplicationName() const { return applicationName; }
         const std::string& getStreamName() const { return streamName; }
+        const Endpoint* getEndpoint() const { return endpoint; }
 
         bool isClosed() const;
         bool isConnected() { return connected; }
 
-        void update(float delta);
-
         void getStats(std::string& str, ReportType reportType) const;
 
         void connect();
@@ -82,10 +120,11 @@ namespace relay
         Stream* getStream() { return stream; }
         void unpublishStream();
 
-        bool sendAudioHeader(const std::vector<uint8_t>& headerData);
-        bool sendVideoHeader(const std::vector<uint8_t>& headerData);
-        bool sendAudioFrame(uint64_t timestamp, const std::vector<uint8_t>& frameData);
-        bool sendVideoFrame(uint64_t timestamp, const std::vector<uint8_t>& frameData, VideoFrameType frameType);
+        bool sendAudioHeader(const Buffer& headerData);
+        bool sendVideoHeader(const Buffer& headerData);
+        // the ingest time is when the input received the frame
+        bool sendAudioFrame(uint64_t timestamp, const Buffer& frameData, std::chrono::steady_clock::time_point ingestTime);
+        bool sendVideoFrame(uint64_t timestamp, const Buffer& frameData, VideoFrameType frameType, std::chrono::steady_clock::time_point ingestTime);
         bool sendMetaData(const amf::Node& newMetaData);
         bool sendTextData(uint64_t timestamp, const amf::Node& textData);
 
@@ -94,13 +133,24 @@ namespace relay
     private:
         void resolveStreamName();
         void updateIdString();
+        bool startHandover(const rtmp::Packet& packet);
+        void finishHandover();
 
         void handleConnect(Socket&);
         void handleConnectError(Socket&);
-        void handleRead(Socket&, const std::vector<uint8_t>& newData);
+        void handleRead(Socket&, ByteQueue& data);
         void handleClose(Socket&);
+        void handleWrite(Socket&);
+
+        void startPing();
+        void handlePing(Timer&);
+        void handlePongTimeout(Timer&);
+        void handleReconnect(Timer&);
+        void handleIdle(Timer&);
+        void handleMeasure(Timer&);
 
-        bool handlePacket(const rtmp::Packet& packet);
+        // media payloads are moved out of the packet
+        bool handlePacket(rtmp::Packet& packet);
 
         bool sendServerBandwidth();
         bool sendClientBandwidth();
@@ -141,8 +191,16 @@ namespace relay
         bool sendStop();
         bool sendStopStatus(double transactionId);
 
-        bool sendAudioData(uint64_t timestamp, const std::vector<uint8_t>& audioData);
-        bool sendVideoData(uint64_t timestamp, const std::vector<uint8_t>& videoData);
+        bool sendAudioData(uint64_t timestamp, const Buffer& audioData);
+        bool sendVideoData(uint64_t timestamp, const Buffer& videoData);
+        bool sendMediaPacket(const rtmp::Packet& packet, const Buffer& payload);
+
+        // fullness of the send queue, 1 when it reaches the size or the duration limit of the endpoint
+        float getSendQueueLoad();
+        void queueFrame(uint64_t timestamp, std::chrono::steady_clock::time_point ingestTime);
+        // records the latency of the frames that the socket has sent
+        void completeFrames();
+        void traceFrame(Trace::Event event, uint64_t timestamp, const Buffer& frameData, rtmp::MessageType messageType);
 
         Relay& relay;
         const uint64_t id;
@@ -154,21 +212,21 @@ namespace relay
         uint32_t bufferSize = 3000;
         Socket socket;
 
-        float timeSincePing = 0.0f;
-        float timeSincePong = 0.0f;
-        float timeSinceConnect = 0.0f;
-        float timeSinceLastData = 0.0f;
+        Timer pingTimer;
+        Timer pongTimer;
+        Timer reconnectTimer;
+        Timer idleTimer;
+        Timer measureTimer;
+        std::chrono::steady_clock::time_point lastDataTime;
         uint32_t connectCount = 0;
         uint32_t addressIndex = 0;
 
-        std::vector<uint8_t> data;
-
         uint32_t inChunkSize = 128;
         uint32_t outChunkSize = 128;
         uint32_t serverBandwidth = 2500000;
 
-        std::map<uint32_t, rtmp::Header> receivedPackets;
-        std::map<uint32_t, rtmp::Header> sentPackets;
+        rtmp::ChunkStreams receivedPackets;
+        rtmp::ChunkStreams sentPackets;
 
         uint32_t invokeId = 0;
         std::map<uint32_t, std::string> invokes;
@@ -183,7 +241,18 @@ namespace relay
         bool streaming = false;
 
         bool videoFrameSent = false;
-        float timeSinceMeasure = 0.0f;
+        bool videoFrameDropped = false; // waiting for a key frame after a drop
+        uint64_t droppedVideoFrames = 0;
+        uint64_t droppedAudioFrames = 0;
+        // frame that is not sent yet
+        struct QueuedFrame
+        {
+            uint64_t position; // end of the frame in the sent data
+            uint64_t timestamp;
+            std::chrono::steady_clock::time_point ingestTime;
+        };
+        std::deque<QueuedFrame> queuedFrames;
+        LatencyHistogram latencyHistogram;
         uint64_t currentAudioBytes = 0;
         uint64_t currentVideoBytes = 0;
         uint64_t audioRate = 0;
@@ -196,5 +265,9 @@ namespace relay
         amf::Version amfVersion = amf::Version::AMF0;
 
         std::string idString;
+        Metrics::Connection metrics;
+
+        Relay* handoverRelay = nullptr;
+        rtmp::Packet handoverPacket;
     };
 }
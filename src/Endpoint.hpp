@@ -9,6 +9,7 @@
 #include "Connection.hpp"
 #include "Stream.hpp"
 #include "Amf.hpp"
+#include "NameMatcher.hpp"
 
 namespace relay
 {
@@ -29,6 +30,13 @@ namespace relay
         uint32_t reconnectCount = 0;
         float pingInterval = 60.0f;
         uint32_t bufferSize = 3000;
+        uint32_t sendQueueSize = 8 * 1024 * 1024; // bytes
+        uint32_t sendQueueDuration = 5000; // milliseconds
+        uint32_t gopCacheSize = 0; // bytes
+        bool lowLatencyJoin = false;
+        uint32_t joinLatency = 100; // milliseconds
+        uint32_t zeroCopyThreshold = 0; // bytes, 0 disables zero copy sends
+        Socket::Options socketOptions;
         amf::Version amfVersion = amf::Version::AMF0;
 
         bool videoStream = true;
@@ -36,6 +44,8 @@ namespace relay
         bool dataStream = true;
         std::string applicationName;
         std::string streamName;
+        NameMatcher applicationNameMatcher; // host endpoints only
+        NameMatcher streamNameMatcher; // host endpoints only
         std::set<std::string> metaDataBlacklist;
 
         bool isNameKnown() const
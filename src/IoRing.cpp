@@ -0,0 +1,324 @@
+//
+//  rtmp_relay
+//
+
+#include "IoRing.hpp"
+
+#ifdef HAVE_IO_URING
+
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "Log.hpp"
+
+namespace relay
+{
+    static const uint32_t COMPLETION_ENTRIES_PER_ENTRY = 8;
+
+    IoRing::~IoRing()
+    {
+        close();
+    }
+
+    bool IoRing::init(uint32_t entryCount)
+    {
+        close();
+
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        // every socket can have a completion waiting
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = entryCount * COMPLETION_ENTRIES_PER_ENTRY;
+
+        ringFd = static_cast<int>(syscall(__NR_io_uring_setup, entryCount, &params));
+
+        if (ringFd == -1)
+        {
+            int error = errno;
+            Log(Log::Level::WARN) << "Failed to create io_uring instance, error: " << error;
+            return false;
+        }
+
+        features = params.features;
+
+        // the timeout of the wait and the poll updates are needed
+        if (!(features & IORING_FEAT_SINGLE_MMAP) ||
+            !(features & IORING_FEAT_EXT_ARG) ||
+            !(features & IORING_FEAT_RSRC_TAGS))
+        {
+            Log(Log::Level::WARN) << "The io_uring of the kernel is too old";
+            close();
+            return false;
+        }
+
+        size_t submissionSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        size_t completionSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        ringSize = (submissionSize > completionSize) ? submissionSize : completionSize;
+
+        void* memory = mmap(nullptr, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+
+        if (memory == MAP_FAILED)
+        {
+            int error = errno;
+            Log(Log::Level::ERR) << "Failed to map the io_uring rings, error: " << error;
+            close();
+            return false;
+        }
+
+        ringMemory = memory;
+
+        entriesSize = params.sq_entries * sizeof(io_uring_sqe);
+        memory = mmap(nullptr, entriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+
+        if (memory == MAP_FAILED)
+        {
+            int error = errno;
+            Log(Log::Level::ERR) << "Failed to map the io_uring submission entries, error: " << error;
+            close();
+            return false;
+        }
+
+        entries = static_cast<io_uring_sqe*>(memory);
+
+        uint8_t* ring = static_cast<uint8_t*>(ringMemory);
+
+        submissionHead = reinterpret_cast<uint32_t*>(ring + params.sq_off.head);
+        submissionTail = reinterpret_cast<uint32_t*>(ring + params.sq_off.tail);
+        submissionArray = reinterpret_cast<uint32_t*>(ring + params.sq_off.array);
+        submissionMask = *reinterpret_cast<uint32_t*>(ring + params.sq_off.ring_mask);
+        submissionEntries = *reinterpret_cast<uint32_t*>(ring + params.sq_off.ring_entries);
+
+        completionHead = reinterpret_cast<uint32_t*>(ring + params.cq_off.head);
+        completionTail = reinterpret_cast<uint32_t*>(ring + params.cq_off.tail);
+        completions = reinterpret_cast<io_uring_cqe*>(ring + params.cq_off.cqes);
+        completionMask = *reinterpret_cast<uint32_t*>(ring + params.cq_off.ring_mask);
+
+        pendingEntries = 0;
+
+        return true;
+    }
+
+    void IoRing::close()
+    {
+        if (entries) munmap(entries, entriesSize);
+        entries = nullptr;
+
+        if (ringMemory) munmap(ringMemory, ringSize);
+        ringMemory = nullptr;
+
+        if (ringFd != -1) ::close(ringFd);
+        ringFd = -1;
+    }
+
+    io_uring_sqe* IoRing::getEntry()
+    {
+        if (ringFd == -1) return nullptr;
+
+        uint32_t tail = *submissionTail;
+
+        // the ring is full, so the queued entries are handed to the kernel
+        if (tail - __atomic_load_n(submissionHead, __ATOMIC_ACQUIRE) >= submissionEntries)
+        {
+            if (!submit() ||
+                tail - __atomic_load_n(submissionHead, __ATOMIC_ACQUIRE) >= submissionEntries)
+            {
+                Log(Log::Level::ERR) << "The io_uring submission ring is full";
+                return nullptr;
+            }
+        }
+
+        uint32_t index = tail & submissionMask;
+        io_uring_sqe* entry = &entries[index];
+        memset(entry, 0, sizeof(*entry));
+        submissionArray[index] = index;
+
+        return entry;
+    }
+
+    bool IoRing::addPoll(int fd, uint32_t events, uint64_t userData)
+    {
+        io_uring_sqe* entry = getEntry();
+        if (!entry) return false;
+
+        entry->opcode = IORING_OP_POLL_ADD;
+        entry->fd = fd;
+        entry->poll32_events = events;
+        entry->user_data = userData;
+
+        __atomic_store_n(submissionTail, *submissionTail + 1, __ATOMIC_RELEASE);
+        ++pendingEntries;
+
+        return true;
+    }
+
+    bool IoRing::updatePoll(uint64_t userData, uint32_t events)
+    {
+        io_uring_sqe* entry = getEntry();
+        if (!entry) return false;
+
+        entry->opcode = IORING_OP_POLL_REMOVE;
+        entry->fd = -1;
+        entry->addr = userData;
+        entry->len = IORING_POLL_UPDATE_EVENTS;
+        entry->poll32_events = events;
+        entry->user_data = 0; // the result is not needed, the poll completes as usual
+
+        __atomic_store_n(submissionTail, *submissionTail + 1, __ATOMIC_RELEASE);
+        ++pendingEntries;
+
+        return true;
+    }
+
+    bool IoRing::removePoll(uint64_t userData)
+    {
+        io_uring_sqe* entry = getEntry();
+        if (!entry) return false;
+
+        entry->opcode = IORING_OP_POLL_REMOVE;
+        entry->fd = -1;
+        entry->addr = userData;
+        entry->user_data = 0;
+
+        __atomic_store_n(submissionTail, *submissionTail + 1, __ATOMIC_RELEASE);
+        ++pendingEntries;
+
+        return true;
+    }
+
+    bool IoRing::addAccept(int fd, uint64_t userData)
+    {
+#ifdef IORING_ACCEPT_MULTISHOT
+        io_uring_sqe* entry = getEntry();
+        if (!entry) return false;
+
+        entry->opcode = IORING_OP_ACCEPT;
+        entry->fd = fd;
+        entry->ioprio = IORING_ACCEPT_MULTISHOT;
+        entry->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        entry->user_data = userData;
+
+        __atomic_store_n(submissionTail, *submissionTail + 1, __ATOMIC_RELEASE);
+        ++pendingEntries;
+
+        return true;
+#else
+        (void)fd;
+        (void)userData;
+        return false;
+#endif
+    }
+
+    bool IoRing::addSendMsg(int fd, const msghdr* message, uint32_t flags, uint64_t userData)
+    {
+        io_uring_sqe* entry = getEntry();
+        if (!entry) return false;
+
+        entry->opcode = IORING_OP_SENDMSG;
+        entry->fd = fd;
+        entry->addr = reinterpret_cast<uint64_t>(message);
+        entry->len = 1;
+        entry->msg_flags = flags;
+        entry->user_data = userData;
+
+        __atomic_store_n(submissionTail, *submissionTail + 1, __ATOMIC_RELEASE);
+        ++pendingEntries;
+
+        return true;
+    }
+
+    bool IoRing::cancel(uint64_t userData)
+    {
+        io_uring_sqe* entry = getEntry();
+        if (!entry) return false;
+
+        entry->opcode = IORING_OP_ASYNC_CANCEL;
+        entry->fd = -1;
+        entry->addr = userData;
+        entry->user_data = 0;
+
+        __atomic_store_n(submissionTail, *submissionTail + 1, __ATOMIC_RELEASE);
+        ++pendingEntries;
+
+        return true;
+    }
+
+    int IoRing::enter(uint32_t toSubmit, uint32_t minComplete, uint32_t flags, const void* arg, size_t argSize)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, arg, argSize));
+    }
+
+    bool IoRing::submit()
+    {
+        while (pendingEntries > 0)
+        {
+            int result = enter(pendingEntries, 0, 0, nullptr, 0);
+
+            if (result < 0)
+            {
+                int error = errno;
+
+                if (error == EINTR) continue;
+
+                Log(Log::Level::ERR) << "Failed to submit to io_uring, error: " << error;
+                return false;
+            }
+
+            pendingEntries -= (static_cast<uint32_t>(result) < pendingEntries) ? static_cast<uint32_t>(result) : pendingEntries;
+
+            if (result == 0) break;
+        }
+
+        return true;
+    }
+
+    bool IoRing::wait(int timeout)
+    {
+        __kernel_timespec timespec;
+        io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+
+        if (timeout >= 0)
+        {
+            timespec.tv_sec = timeout / 1000;
+            timespec.tv_nsec = static_cast<long long>(timeout % 1000) * 1000000;
+            arg.ts = reinterpret_cast<uint64_t>(&timespec);
+        }
+
+        int result = enter(pendingEntries, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+
+        if (result < 0)
+        {
+            int error = errno;
+
+            // the timeout expired, a signal arrived or the completions have to be reaped first
+            if (error == ETIME || error == EINTR || error == EBUSY) return true;
+
+            Log(Log::Level::ERR) << "Failed to wait for io_uring completions, error: " << error;
+            return false;
+        }
+
+        pendingEntries -= (static_cast<uint32_t>(result) < pendingEntries) ? static_cast<uint32_t>(result) : pendingEntries;
+
+        return true;
+    }
+
+    void IoRing::getCompletions(std::vector<io_uring_cqe>& result)
+    {
+        result.clear();
+
+        uint32_t head = *completionHead;
+        uint32_t tail = __atomic_load_n(completionTail, __ATOMIC_ACQUIRE);
+
+        for (; head != tail; ++head)
+        {
+            result.push_back(completions[head & completionMask]);
+        }
+
+        __atomic_store_n(completionHead, head, __ATOMIC_RELEASE);
+    }
+}
+
+#endif
@@ -0,0 +1,87 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#if defined(__linux__) && defined(__has_include)
+#  if __has_include(<linux/io_uring.h>)
+#    include <linux/io_uring.h>
+#    ifdef IORING_FEAT_RSRC_TAGS // poll updates are available from the same kernel version
+#      define HAVE_IO_URING 1
+#    endif
+#  endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct msghdr;
+
+namespace relay
+{
+    // submission and completion rings of io_uring, used without liburing
+    class IoRing
+    {
+    public:
+        IoRing() {}
+        ~IoRing();
+
+        IoRing(const IoRing&) = delete;
+        IoRing& operator=(const IoRing&) = delete;
+
+        IoRing(IoRing&&) = delete;
+        IoRing& operator=(IoRing&&) = delete;
+
+        bool init(uint32_t entries);
+        void close();
+        bool isOpen() const { return ringFd != -1; }
+
+        // queues a one-shot poll of the descriptor, its completion carries the user data
+        bool addPoll(int fd, uint32_t events, uint64_t userData);
+        // changes the events of a poll that has not completed yet
+        bool updatePoll(uint64_t userData, uint32_t events);
+        bool removePoll(uint64_t userData);
+        // queues a multishot accept, the accepted descriptors are non-blocking, returns false if it is not supported
+        bool addAccept(int fd, uint64_t userData);
+        // the message and its segments have to be valid until the entry is submitted, the data until it completes
+        bool addSendMsg(int fd, const msghdr* message, uint32_t flags, uint64_t userData);
+        // cancels the request with the user data, like the multishot accept
+        bool cancel(uint64_t userData);
+
+        // submits the queued entries without waiting
+        bool submit();
+        // submits the queued entries and waits for a completion, the timeout is in milliseconds (-1 to wait forever)
+        bool wait(int timeout);
+        void getCompletions(std::vector<io_uring_cqe>& completions);
+
+    private:
+        io_uring_sqe* getEntry();
+        int enter(uint32_t toSubmit, uint32_t minComplete, uint32_t flags, const void* arg, size_t argSize);
+
+        int ringFd = -1;
+        uint32_t features = 0;
+
+        void* ringMemory = nullptr;
+        size_t ringSize = 0;
+        io_uring_sqe* entries = nullptr;
+        size_t entriesSize = 0;
+
+        uint32_t* submissionHead = nullptr;
+        uint32_t* submissionTail = nullptr;
+        uint32_t* submissionArray = nullptr;
+        uint32_t submissionMask = 0;
+        uint32_t submissionEntries = 0;
+        uint32_t pendingEntries = 0; // queued but not submitted
+
+        uint32_t* completionHead = nullptr;
+        uint32_t* completionTail = nullptr;
+        io_uring_cqe* completions = nullptr;
+        uint32_t completionMask = 0;
+    };
+}
+
+#endif
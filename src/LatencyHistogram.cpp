@@ -0,0 +1,91 @@
+//
+//  rtmp_relay
+//
+
+#include <algorithm>
+#include <cstdio>
+#include "LatencyHistogram.hpp"
+
+namespace relay
+{
+    LatencyHistogram::LatencyHistogram():
+        buckets(BUCKETS, 0)
+    {
+    }
+
+    uint32_t LatencyHistogram::getIndex(uint64_t value)
+    {
+        if (value < SUB_BUCKETS) return static_cast<uint32_t>(value);
+
+        uint32_t highestBit = 0;
+        for (uint64_t v = value; v > 1; v >>= 1) ++highestBit;
+
+        // the value shifted right by the shift is between the half and the full amount of sub-buckets
+        uint32_t shift = highestBit - SUB_BUCKET_BITS + 1;
+        uint32_t subBucket = static_cast<uint32_t>(value >> shift);
+        uint32_t index = SUB_BUCKETS + (shift - 1) * HALF_SUB_BUCKETS + (subBucket - HALF_SUB_BUCKETS);
+
+        return (index < BUCKETS) ? index : BUCKETS - 1;
+    }
+
+    uint64_t LatencyHistogram::getHighestValue(uint32_t index)
+    {
+        if (index < SUB_BUCKETS) return index;
+
+        uint32_t shift = (index - SUB_BUCKETS) / HALF_SUB_BUCKETS + 1;
+        uint64_t subBucket = HALF_SUB_BUCKETS + (index - SUB_BUCKETS) % HALF_SUB_BUCKETS;
+
+        return ((subBucket + 1) << shift) - 1;
+    }
+
+    void LatencyHistogram::record(uint64_t value)
+    {
+        ++buckets[getIndex(value)];
+        ++count;
+        if (value > max) max = value;
+    }
+
+    void LatencyHistogram::clear()
+    {
+        std::fill(buckets.begin(), buckets.end(), 0);
+        count = 0;
+        max = 0;
+    }
+
+    uint64_t LatencyHistogram::getPercentile(double fraction) const
+    {
+        if (count == 0) return 0;
+
+        uint64_t rank = static_cast<uint64_t>(fraction * count + 0.5);
+        if (rank < 1) rank = 1;
+        if (rank > count) rank = count;
+
+        uint64_t total = 0;
+
+        for (uint32_t index = 0; index < BUCKETS; ++index)
+        {
+            total += buckets[index];
+
+            if (total >= rank)
+            {
+                uint64_t value = getHighestValue(index);
+                return (value < max) ? value : max;
+            }
+        }
+
+        return max;
+    }
+
+    std::string LatencyHistogram::getPercentilesString() const
+    {
+        if (count == 0) return "";
+
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%.2f/%.2f/%.2f",
+                 getPercentile(0.5) / 1000.0,
+                 getPercentile(0.99) / 1000.0,
+                 getPercentile(0.999) / 1000.0);
+
+        return buffer;
+    }
+}
@@ -0,0 +1,46 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace relay
+{
+    // log-linear histogram of latencies in microseconds, a recorded value is off by at most about 3%
+    class LatencyHistogram
+    {
+    public:
+        LatencyHistogram();
+
+        void record(uint64_t value);
+        void clear();
+
+        uint64_t getCount() const { return count; }
+        uint64_t getMax() const { return max; }
+
+        // the value that the given fraction (0 to 1) of the recorded values do not exceed
+        uint64_t getPercentile(double fraction) const;
+
+        // p50/p99/p999 in milliseconds, empty if nothing was recorded
+        std::string getPercentilesString() const;
+
+    private:
+        // each power of two above the first range is split into half of the sub-buckets
+        static const uint32_t SUB_BUCKET_BITS = 6;
+        static const uint32_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+        static const uint32_t HALF_SUB_BUCKETS = SUB_BUCKETS / 2;
+        static const uint32_t MAX_VALUE_BITS = 40; // about 12 days
+        static const uint32_t BUCKETS = SUB_BUCKETS + (MAX_VALUE_BITS - SUB_BUCKET_BITS) * HALF_SUB_BUCKETS;
+
+        static uint32_t getIndex(uint64_t value);
+        static uint64_t getHighestValue(uint32_t index);
+
+        std::vector<uint64_t> buckets;
+        uint64_t count = 0;
+        uint64_t max = 0;
+    };
+}
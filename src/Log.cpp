@@ -2,9 +2,16 @@
 //  rtmp_relay
 //
 
+#include <atomic>
 #include <chrono>
-#include <iostream>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <system_error>
+#include <thread>
 #ifdef _WIN32
 #  include <windows.h>
 #  include <strsafe.h>
@@ -12,6 +19,7 @@
 #  include <sys/syslog.h>
 #endif
 #include "Log.hpp"
+#include "LogQueue.hpp"
 
 namespace relay
 {
@@ -27,42 +35,253 @@ namespace relay
     bool Log::syslogEnabled = false;
 #endif
 
-    void Log::flush()
+    static FILE* file = nullptr;
+
+    // state of the asynchronous logging, the queue is only replaced while no other thread logs
+    static std::unique_ptr<LogQueue> queue;
+    static std::thread thread;
+    static std::atomic<bool> running(false);
+    static std::atomic<bool> waiting(false);
+    static std::mutex waitMutex;
+    static std::condition_variable waitCondition;
+    static std::atomic<uint64_t> droppedCount(0);
+
+    // stops the thread before the exit
+    static struct AsyncStopper
     {
-        if (!s.empty())
+        ~AsyncStopper() { Log::stopAsync(); }
+    } asyncStopper;
+
+    // the prefix changes once a second, so it is formatted only then
+    static const std::string& getTimePrefix(std::time_t t)
+    {
+        static thread_local std::time_t prefixTime = -1;
+        static thread_local std::string prefix;
+
+        if (t != prefixTime)
         {
-            auto n = std::chrono::system_clock::now();
-            auto t = std::chrono::system_clock::to_time_t(n);
-            tm* time = localtime(&t);
+            tm time;
+#ifdef _WIN32
+            localtime_s(&time, &t);
+#else
+            localtime_r(&t, &time);
+#endif
             char buffer[32];
-            strftime(buffer, sizeof(buffer), "%Y.%m.%d %H:%M:%S", time);
+            strftime(buffer, sizeof(buffer), "%Y.%m.%d %H:%M:%S", &time);
 
-            if (level == Level::ERR ||
-                level == Level::WARN)
-                std::cerr << buffer << ": " << s << std::endl;
-            else
-                std::cout << buffer << ": " << s << std::endl;
+            prefix = std::string(buffer) + ": ";
+            prefixTime = t;
+        }
+
+        return prefix;
+    }
+
+    static FILE* getStream(Log::Level level)
+    {
+        if (file) return file;
 
+        return (level == Log::Level::ERR || level == Log::Level::WARN) ? stderr : stdout;
+    }
+
+    static void writeSystemLog(Log::Level level, const std::string& s)
+    {
 #ifdef _WIN32
-            wchar_t szBuffer[MAX_PATH];
-            MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, szBuffer, MAX_PATH);
-            StringCchCatW(szBuffer, sizeof(szBuffer), L"\n");
-            OutputDebugStringW(szBuffer);
+        (void)level;
+        wchar_t szBuffer[MAX_PATH];
+        MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, szBuffer, MAX_PATH);
+        StringCchCatW(szBuffer, sizeof(szBuffer), L"\n");
+        OutputDebugStringW(szBuffer);
 #elif defined(LOG_SYSLOG)
-            if (syslogEnabled)
+        if (Log::syslogEnabled)
+        {
+            int priority = 0;
+            switch (level)
+            {
+                case Log::Level::ERR: priority = LOG_ERR; break;
+                case Log::Level::WARN: priority = LOG_WARNING; break;
+                case Log::Level::INFO: priority = LOG_INFO; break;
+                case Log::Level::ALL: priority = LOG_DEBUG; break;
+                default: break;
+            }
+            syslog(priority, "%s", s.c_str());
+        }
+#else
+        (void)level;
+        (void)s;
+#endif
+    }
+
+    static void writeLines(FILE* stream, const std::string& lines)
+    {
+        fwrite(lines.data(), 1, lines.size(), stream);
+        fflush(stream);
+    }
+
+    static void run()
+    {
+        static const size_t BATCH_SIZE = 256;
+
+        LogQueue::Record record;
+        std::string outLines;
+        std::string errorLines;
+        uint64_t reportedDroppedCount = 0;
+        auto reportTime = std::chrono::steady_clock::now();
+
+        for (;;)
+        {
+            size_t count = 0;
+
+            while (count < BATCH_SIZE && queue->pop(record))
+            {
+                ++count;
+
+                std::string& lines = (getStream(record.level) == stderr) ? errorLines : outLines;
+                lines += getTimePrefix(record.time);
+                lines += record.text;
+                lines += '\n';
+
+                writeSystemLog(record.level, record.text);
+            }
+
+            uint64_t currentDroppedCount = droppedCount.load(std::memory_order_relaxed);
+            auto now = std::chrono::steady_clock::now();
+
+            if (currentDroppedCount != reportedDroppedCount &&
+                now - reportTime >= std::chrono::seconds(1))
+            {
+                errorLines += getTimePrefix(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()));
+                errorLines += "Log queue full, dropped " + std::to_string(currentDroppedCount - reportedDroppedCount) + " lines\n";
+                reportedDroppedCount = currentDroppedCount;
+                reportTime = now;
+            }
+
+            // a single write per batch and stream
+            if (!outLines.empty())
+            {
+                writeLines(getStream(Log::Level::INFO), outLines);
+                outLines.clear();
+            }
+
+            if (!errorLines.empty())
+            {
+                writeLines(getStream(Log::Level::ERR), errorLines);
+                errorLines.clear();
+            }
+
+            if (count == 0)
+            {
+                if (!running.load(std::memory_order_acquire)) break;
+
+                // the timeout also bounds the delay of a missed wakeup
+                std::unique_lock<std::mutex> lock(waitMutex);
+                waiting.store(true);
+                if (queue->isEmpty() && running.load()) waitCondition.wait_for(lock, std::chrono::milliseconds(100));
+                waiting.store(false);
+            }
+        }
+    }
+
+    bool Log::setFile(const std::string& path)
+    {
+        FILE* newFile = nullptr;
+
+        if (!path.empty())
+        {
+            newFile = fopen(path.c_str(), "a");
+
+            if (!newFile)
+            {
+                Log(Log::Level::ERR) << "Failed to open log file " << path;
+                return false;
+            }
+        }
+
+        FILE* oldFile = file;
+        file = newFile;
+        if (oldFile) fclose(oldFile);
+
+        return true;
+    }
+
+    bool Log::startAsync(size_t queueSize)
+    {
+        if (running) return true;
+
+        queue.reset(new LogQueue(queueSize));
+        running = true;
+
+        try
+        {
+            thread = std::thread(run);
+        }
+        catch (const std::system_error&)
+        {
+            running = false;
+            queue.reset();
+            Log(Log::Level::ERR) << "Failed to start the log thread";
+            return false;
+        }
+
+        return true;
+    }
+
+    void Log::stopAsync()
+    {
+        if (!running) return;
+
+        running = false;
+
+        {
+            std::lock_guard<std::mutex> lock(waitMutex);
+            waitCondition.notify_one();
+        }
+
+        // the thread writes the remaining lines before it exits
+        thread.join();
+        queue.reset();
+    }
+
+    bool Log::isAsync()
+    {
+        return running;
+    }
+
+    uint64_t Log::getDroppedCount()
+    {
+        return droppedCount;
+    }
+
+    void Log::flush()
+    {
+        if (!s.empty())
+        {
+            std::time_t t = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+
+            if (running.load(std::memory_order_acquire))
             {
-                int priority = 0;
-                switch (level)
+                LogQueue::Record record;
+                record.level = level;
+                record.time = t;
+                record.text.swap(s);
+
+                if (!queue->push(record))
                 {
-                    case Level::ERR: priority = LOG_ERR; break;
-                    case Level::WARN: priority = LOG_WARNING; break;
-                    case Level::INFO: priority = LOG_INFO; break;
-                    case Level::ALL: priority = LOG_DEBUG; break;
-                    default: break;
+                    droppedCount.fetch_add(1, std::memory_order_relaxed);
+                }
+                else if (waiting.load())
+                {
+                    std::lock_guard<std::mutex> lock(waitMutex);
+                    waitCondition.notify_one();
                 }
-                syslog(priority, "%s", s.c_str());
             }
-#endif
+            else
+            {
+                // write the whole line at once, so that lines of different workers do not interleave
+                std::string line = getTimePrefix(t) + s + "\n";
+                writeLines(getStream(level), line);
+                writeSystemLog(level, s);
+            }
+
             s.clear();
         }
     }
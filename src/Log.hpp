@@ -4,8 +4,24 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
+// the most verbose level that is compiled in (0 for no logs and 4 for all logs)
+#ifndef LOG_LEVEL
+#  define LOG_LEVEL 4
+#endif
+
+// false if the level is compiled out or under the threshold, guards log statements that are built in several steps
+#define RELAY_LOG_ENABLED(level) \
+    (static_cast<int>(level) <= LOG_LEVEL && (level) <= relay::Log::threshold)
+
+// skips the statement, including the evaluation of its arguments, if the level is compiled out or under the threshold
+#define RELAY_LOG(level) \
+    if (!RELAY_LOG_ENABLED(level)) {} \
+    else relay::Log(level)
+
 namespace relay
 {
     class Log
@@ -23,6 +39,15 @@ namespace relay
         static Level threshold;
         static bool syslogEnabled;
 
+        // writes the lines to the file instead of the standard output, an empty path restores the standard output
+        static bool setFile(const std::string& path);
+
+        // moves the writing to a background thread, the lines that do not fit in the queue are dropped
+        static bool startAsync(size_t queueSize);
+        static void stopAsync();
+        static bool isAsync();
+        static uint64_t getDroppedCount();
+
         Log()
         {
         }
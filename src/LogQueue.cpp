@@ -0,0 +1,84 @@
+//
+//  rtmp_relay
+//
+
+#include "LogQueue.hpp"
+
+namespace relay
+{
+    LogQueue::LogQueue(size_t size)
+    {
+        size_t capacity = 2;
+        while (capacity < size) capacity <<= 1;
+
+        cells.reset(new Cell[capacity]);
+        mask = capacity - 1;
+
+        for (size_t i = 0; i < capacity; ++i)
+        {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        pushPosition.value.store(0, std::memory_order_relaxed);
+        popPosition.value.store(0, std::memory_order_relaxed);
+    }
+
+    bool LogQueue::push(Record& record)
+    {
+        size_t position = pushPosition.value.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+            Cell& cell = cells[position & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+            if (difference == 0)
+            {
+                // claim the position, retry with the new position if another producer was faster
+                if (pushPosition.value.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    cell.record.level = record.level;
+                    cell.record.time = record.time;
+                    cell.record.text.swap(record.text);
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (difference < 0)
+            {
+                return false; // the consumer has not freed the cell yet
+            }
+            else
+            {
+                position = pushPosition.value.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool LogQueue::pop(Record& record)
+    {
+        size_t position = popPosition.value.load(std::memory_order_relaxed);
+        Cell& cell = cells[position & mask];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+
+        if (sequence != position + 1) return false;
+
+        record.level = cell.record.level;
+        record.time = cell.record.time;
+        record.text.swap(cell.record.text);
+        cell.record.text.clear();
+
+        popPosition.value.store(position + 1, std::memory_order_relaxed);
+        cell.sequence.store(position + mask + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    bool LogQueue::isEmpty() const
+    {
+        size_t position = popPosition.value.load(std::memory_order_relaxed);
+
+        return cells[position & mask].sequence.load(std::memory_order_acquire) != position + 1;
+    }
+}
@@ -0,0 +1,64 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+#include "Log.hpp"
+
+namespace relay
+{
+    // bounded lock-free queue of log records, any thread can push, only the log thread pops
+    class LogQueue
+    {
+    public:
+        struct Record
+        {
+            Log::Level level = Log::Level::INFO;
+            std::time_t time = 0;
+            std::string text;
+        };
+
+        // the size is rounded up to a power of two
+        explicit LogQueue(size_t size);
+
+        LogQueue(const LogQueue&) = delete;
+        LogQueue(LogQueue&&) = delete;
+        LogQueue& operator=(const LogQueue&) = delete;
+        LogQueue& operator=(LogQueue&&) = delete;
+
+        // returns false if the queue is full
+        bool push(Record& record);
+        // returns false if the queue is empty
+        bool pop(Record& record);
+        // can only be called by the consumer
+        bool isEmpty() const;
+
+    private:
+        // the sequence tells whether the cell is free for the producer of a position or holds the record for the consumer
+        struct Cell
+        {
+            std::atomic<size_t> sequence;
+            Record record;
+        };
+
+        std::unique_ptr<Cell[]> cells;
+        size_t mask;
+
+        // padded to a cache line, so that producers and the consumer do not share one
+        struct Position
+        {
+            std::atomic<size_t> value;
+            char padding[64 - sizeof(std::atomic<size_t>)];
+        };
+
+        Position pushPosition;
+        Position popPosition;
+    };
+}
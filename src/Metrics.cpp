@@ -0,0 +1,178 @@
+//
+//  rtmp_relay
+//
+
+#include <mutex>
+#include "Metrics.hpp"
+
+namespace relay
+{
+    // connections that are exported, linked through the connections themselves
+    static std::mutex connectionMutex;
+    static Metrics::Connection* firstConnection = nullptr;
+
+    std::atomic<uint64_t> Metrics::handshakeFailures{0};
+
+    const uint64_t Metrics::ITERATION_BOUNDS[ITERATION_BUCKETS] = {
+        50, 100, 250, 500, 1000, 5000, 10000, 100000
+    };
+    std::atomic<uint64_t> Metrics::iterationCounts[ITERATION_BUCKETS + 1];
+    std::atomic<uint64_t> Metrics::iterationTime{0};
+
+    static std::string escapeLabel(const std::string& value)
+    {
+        std::string result;
+        result.reserve(value.size());
+
+        for (char c : value)
+        {
+            switch (c)
+            {
+                case '\\': result += "\\\\"; break;
+                case '"': result += "\\\""; break;
+                case '\n': result += "\\n"; break;
+                default: result += c;
+            }
+        }
+
+        return result;
+    }
+
+    Metrics::Connection::Connection()
+    {
+        std::lock_guard<std::mutex> lock(connectionMutex);
+
+        next = firstConnection;
+        if (next) next->previous = this;
+        firstConnection = this;
+    }
+
+    Metrics::Connection::~Connection()
+    {
+        std::lock_guard<std::mutex> lock(connectionMutex);
+
+        if (previous) previous->next = next;
+        else firstConnection = next;
+        if (next) next->previous = previous;
+    }
+
+    void Metrics::Connection::setLabels(uint64_t id, bool host, const std::string& direction,
+                                        const std::string& applicationName, const std::string& streamName)
+    {
+        std::string newStreamLabels = "application=\"" + escapeLabel(applicationName) +
+            "\",stream=\"" + escapeLabel(streamName) + "\"";
+        std::string newLabels = "id=\"" + std::to_string(id) +
+            "\",type=\"" + (host ? "host" : "client") +
+            "\",direction=\"" + direction + "\"," + newStreamLabels;
+
+        std::lock_guard<std::mutex> lock(connectionMutex);
+
+        labels = std::move(newLabels);
+        streamLabels = std::move(newStreamLabels);
+        input = (direction == "input");
+    }
+
+    void Metrics::recordIteration(std::chrono::steady_clock::duration duration)
+    {
+        uint64_t value = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+
+        uint32_t bucket = 0;
+        while (bucket < ITERATION_BUCKETS && value > ITERATION_BOUNDS[bucket]) ++bucket;
+
+        iterationCounts[bucket].fetch_add(1, std::memory_order_relaxed);
+        iterationTime.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    static void addFamily(std::string& str, const char* name, const char* type, const char* help)
+    {
+        str += "# HELP ";
+        str += name;
+        str += " ";
+        str += help;
+        str += "\n# TYPE ";
+        str += name;
+        str += " ";
+        str += type;
+        str += "\n";
+    }
+
+    static void addSample(std::string& str, const char* name, const std::string& labels, uint64_t value)
+    {
+        str += name;
+        if (!labels.empty()) str += "{" + labels + "}";
+        str += " " + std::to_string(value) + "\n";
+    }
+
+    void Metrics::getMetrics(std::string& str)
+    {
+        struct Family
+        {
+            const char* name;
+            const char* type;
+            const char* help;
+            std::atomic<uint64_t> Connection::*value;
+        };
+
+        static const Family families[] = {
+            {"relay_connection_received_bytes_total", "counter", "Bytes received by the connection", &Connection::receivedBytes},
+            {"relay_connection_sent_bytes_total", "counter", "Bytes written to the socket of the connection", &Connection::sentBytes},
+            {"relay_connection_received_messages_total", "counter", "RTMP messages received by the connection", &Connection::receivedMessages},
+            {"relay_connection_sent_media_messages_total", "counter", "Audio and video messages sent by the connection", &Connection::sentMediaMessages},
+            {"relay_connection_send_queue_bytes", "gauge", "Bytes waiting in the send queue of the connection", &Connection::sendQueueBytes},
+            {"relay_connection_dropped_frames_total", "counter", "Frames dropped because the send queue was full", &Connection::droppedFrames},
+            {"relay_connection_reconnects_total", "counter", "Reconnect attempts of the connection", &Connection::reconnects}
+        };
+
+        std::lock_guard<std::mutex> lock(connectionMutex);
+
+        uint64_t connectionCount = 0;
+        for (const Connection* connection = firstConnection; connection; connection = connection->next)
+        {
+            ++connectionCount;
+        }
+
+        addFamily(str, "relay_connections", "gauge", "Open connections");
+        addSample(str, "relay_connections", std::string(), connectionCount);
+
+        for (const Family& family : families)
+        {
+            addFamily(str, family.name, family.type, family.help);
+
+            for (const Connection* connection = firstConnection; connection; connection = connection->next)
+            {
+                addSample(str, family.name, connection->labels,
+                          (connection->*family.value).load(std::memory_order_relaxed));
+            }
+        }
+
+        addFamily(str, "relay_stream_bitrate_bits_per_second", "gauge", "Bitrate of the published stream, measured every second");
+
+        for (const Connection* connection = firstConnection; connection; connection = connection->next)
+        {
+            if (!connection->input) continue;
+
+            addSample(str, "relay_stream_bitrate_bits_per_second", connection->streamLabels + ",media=\"audio\"",
+                      connection->audioBitrate.load(std::memory_order_relaxed));
+            addSample(str, "relay_stream_bitrate_bits_per_second", connection->streamLabels + ",media=\"video\"",
+                      connection->videoBitrate.load(std::memory_order_relaxed));
+        }
+
+        addFamily(str, "relay_handshake_failures_total", "counter", "Connections that closed or failed during the RTMP handshake");
+        addSample(str, "relay_handshake_failures_total", std::string(), handshakeFailures.load(std::memory_order_relaxed));
+
+        addFamily(str, "relay_event_loop_iteration_seconds", "histogram", "Time that an event loop iteration spent on handling events");
+
+        uint64_t count = 0;
+        for (uint32_t bucket = 0; bucket <= ITERATION_BUCKETS; ++bucket)
+        {
+            count += iterationCounts[bucket].load(std::memory_order_relaxed);
+
+            std::string bound = (bucket < ITERATION_BUCKETS) ?
+                std::to_string(ITERATION_BOUNDS[bucket] / 1000000.0) : "+Inf";
+            str += "relay_event_loop_iteration_seconds_bucket{le=\"" + bound + "\"} " + std::to_string(count) + "\n";
+        }
+
+        str += "relay_event_loop_iteration_seconds_sum " + std::to_string(iterationTime.load(std::memory_order_relaxed) / 1000000.0) + "\n";
+        str += "relay_event_loop_iteration_seconds_count " + std::to_string(count) + "\n";
+    }
+}
@@ -0,0 +1,74 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace relay
+{
+    // counters that the workers update and the /metrics endpoint reads without stopping them
+    class Metrics
+    {
+    public:
+        // counters of a connection, exported while the object exists
+        class Connection
+        {
+            friend Metrics;
+        public:
+            Connection();
+            ~Connection();
+
+            Connection(const Connection&) = delete;
+            Connection& operator=(const Connection&) = delete;
+
+            Connection(Connection&&) = delete;
+            Connection& operator=(Connection&&) = delete;
+
+            void setLabels(uint64_t id, bool host, const std::string& direction,
+                           const std::string& applicationName, const std::string& streamName);
+
+            std::atomic<uint64_t> receivedBytes{0};
+            std::atomic<uint64_t> sentBytes{0};
+            std::atomic<uint64_t> receivedMessages{0};
+            std::atomic<uint64_t> sentMediaMessages{0};
+            std::atomic<uint64_t> sendQueueBytes{0};
+            std::atomic<uint64_t> droppedFrames{0};
+            std::atomic<uint64_t> reconnects{0};
+            std::atomic<uint64_t> audioBitrate{0}; // bits per second of the received audio
+            std::atomic<uint64_t> videoBitrate{0}; // bits per second of the received video
+
+        private:
+            // guarded by the mutex of the registry
+            std::string labels;
+            std::string streamLabels;
+            bool input = false;
+            Connection* previous = nullptr;
+            Connection* next = nullptr;
+        };
+
+        static void addHandshakeFailure()
+        {
+            handshakeFailures.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // time that an event loop iteration spent on handling events
+        static void recordIteration(std::chrono::steady_clock::duration duration);
+
+        // Prometheus text exposition format
+        static void getMetrics(std::string& str);
+
+    private:
+        static std::atomic<uint64_t> handshakeFailures;
+
+        // upper bounds of the iteration time buckets in microseconds
+        static const uint32_t ITERATION_BUCKETS = 8;
+        static const uint64_t ITERATION_BOUNDS[ITERATION_BUCKETS];
+        static std::atomic<uint64_t> iterationCounts[ITERATION_BUCKETS + 1];
+        static std::atomic<uint64_t> iterationTime;
+    };
+}
@@ -0,0 +1,38 @@
+//
+//  rtmp_relay
+//
+
+#include "NameMatcher.hpp"
+#include "Utils.hpp"
+
+namespace relay
+{
+    bool NameMatcher::compile(const std::string& newPattern)
+    {
+        pattern = newPattern;
+        literal = isValidName(pattern);
+        regex.reset();
+
+        if (!literal)
+        {
+            try
+            {
+                regex = std::make_shared<const std::regex>(pattern, std::regex::optimize);
+            }
+            catch (const std::regex_error&)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool NameMatcher::match(const std::string& name) const
+    {
+        if (pattern.empty()) return true;
+        if (literal) return name == pattern;
+
+        return std::regex_match(name, *regex);
+    }
+}
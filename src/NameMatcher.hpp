@@ -0,0 +1,28 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <memory>
+#include <regex>
+#include <string>
+
+namespace relay
+{
+    // application or stream name filter of an endpoint, compiled once when the configuration is loaded
+    class NameMatcher
+    {
+    public:
+        // returns false if the pattern is not a valid regex
+        bool compile(const std::string& newPattern);
+
+        // an empty pattern matches every name
+        bool match(const std::string& name) const;
+
+    private:
+        std::string pattern;
+        bool literal = true; // pattern without regex characters, compared directly
+        std::shared_ptr<const std::regex> regex;
+    };
+}
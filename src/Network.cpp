@@ -4,6 +4,12 @@
 
 #include <algorithm>
 #include <chrono>
+#include <cstring>
+#include <limits>
+#include <thread>
+#ifdef _MSC_VER
+#  include <intrin.h>
+#endif
 #ifdef _WIN32
 #  define WIN32_LEAN_AND_MEAN
 #  define NOMINMAX
@@ -14,139 +20,1071 @@
 #  include <sys/socket.h>
 #  include <netinet/in.h>
 #  include <poll.h>
+#  include <unistd.h>
+#  include <fcntl.h>
+#endif
+#ifdef __linux__
+#  include <sys/eventfd.h>
 #endif
 #include "Network.hpp"
 #include "Socket.hpp"
 #include "Log.hpp"
+#include "Metrics.hpp"
 
 namespace relay
 {
-    Network::Network()
+#ifdef HAVE_IO_URING
+    static const uint32_t RING_ENTRIES = 1024;
+    // kinds of the requests in the two upper bits of the user data
+    static const uint64_t RING_POLL = 0;
+    static const uint64_t RING_ACCEPT = static_cast<uint64_t>(1) << 62;
+    static const uint64_t RING_SEND = static_cast<uint64_t>(2) << 62;
+    static const uint64_t RING_KIND_MASK = static_cast<uint64_t>(3) << 62;
+    static const uint32_t RING_GENERATION_MASK = 0x3FFFFFFF;
+#endif
+    // milliseconds between the checks of the completions of the closed sockets
+    static const int LINGER_CHECK_INTERVAL = 100;
+
+    Network::Network():
+        startTime(std::chrono::steady_clock::now())
+    {
+        // the epoll or io_uring instance is created by setBackend, after the process has daemonized
+    }
+
+    Network::~Network()
     {
-        previousTime = std::chrono::steady_clock::now();
+#ifdef HAVE_IO_URING
+        // the kernel does not read the buffers of the sends after the ring is closed
+        ring.close();
+        ringSends.clear();
+#endif
+
+        for (const LingeringSocket& lingeringSocket : lingeringSockets)
+        {
+#ifdef _WIN32
+            closesocket(lingeringSocket.socketFd);
+#else
+            ::close(lingeringSocket.socketFd);
+#endif
+        }
+
+#ifdef __linux__
+        if (epollFd != -1) ::close(epollFd);
+#endif
+#ifndef _WIN32
+        if (wakeupReadFd != -1) ::close(wakeupReadFd);
+        if (wakeupWriteFd != -1 && wakeupWriteFd != wakeupReadFd) ::close(wakeupWriteFd);
+#endif
     }
 
     bool Network::update()
     {
-        for (Socket* socket : socketDeleteSet)
+        // block until a socket is ready or the earliest timer is due
+        int timeout = getTimeout();
+        bool result = true;
+
+        // the closed sockets do not wake the loop, so their completions are checked periodically
+        if (!lingeringSockets.empty() && (timeout < 0 || timeout > LINGER_CHECK_INTERVAL))
         {
-            auto i = std::find(sockets.begin(), sockets.end(), socket);
+            timeout = LINGER_CHECK_INTERVAL;
+        }
+        eventTime = std::chrono::steady_clock::now();
 
-            if (i != sockets.end())
+#ifdef _WIN32
+        if (!socketFds.empty())
+#else
+        if (!socketFds.empty() || wakeupReadFd != -1)
+#endif
+        {
+            switch (backend)
             {
-                sockets.erase(i);
+#ifdef HAVE_IO_URING
+                case Backend::IO_URING: result = ringSockets(timeout); break;
+#endif
+#ifdef __linux__
+                case Backend::EPOLL: result = epollSockets(timeout); break;
+#endif
+                default: result = pollSockets(timeout); break;
             }
         }
+        else if (timeout > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+            eventTime = std::chrono::steady_clock::now();
+        }
 
-        socketDeleteSet.clear();
+        updateTimers();
+        flushSockets();
 
-        for (Socket* socket : socketAddSet)
+        if (!lingeringSockets.empty())
         {
-            auto i = std::find(sockets.begin(), sockets.end(), socket);
+            uint64_t ticks = getTicks();
 
-            if (i == sockets.end())
+            if (ticks - lingerCheckTick >= static_cast<uint64_t>(LINGER_CHECK_INTERVAL))
             {
-                sockets.push_back(socket);
+                lingerCheckTick = ticks;
+                updateLingeringSockets();
             }
         }
 
-        socketAddSet.clear();
+        Metrics::recordIteration(std::chrono::steady_clock::now() - eventTime);
+
+        return result;
+    }
 
-        auto currentTime = std::chrono::steady_clock::now();
-        auto diff = std::chrono::duration_cast<std::chrono::microseconds>(currentTime - previousTime);
+    bool Network::setBackend(Backend newBackend)
+    {
+#ifdef __linux__
+        if (newBackend == backend) return true;
 
-        float delta = diff.count() / 1000000000.0f;
-        previousTime = currentTime;
+        // the descriptors are registered again with the new backend
+        if (epollFd != -1)
+        {
+            ::close(epollFd);
+            epollFd = -1;
+        }
 
-        std::vector<pollfd> pollFds;
-        pollFds.reserve(sockets.size());
+#ifdef HAVE_IO_URING
+        ring.close();
+        ringPolls.clear();
+        ringMultishotAccept = true;
+        ringSends.clear();
+        ringDeferredCompletions.clear();
+#endif
+
+        backend = Backend::POLL;
+        bool result = true;
 
-        for (auto socket : sockets)
+        if (newBackend == Backend::IO_URING)
         {
-            if (socket->socketFd != INVALID_SOCKET)
+#ifdef HAVE_IO_URING
+            if (ring.init(RING_ENTRIES))
             {
-                pollfd pollFd;
-                pollFd.fd = socket->socketFd;
-                pollFd.events = POLLIN | POLLOUT;
+                backend = Backend::IO_URING;
+            }
+            else
+#endif
+            {
+                Log(Log::Level::WARN) << "io_uring is not available, falling back to epoll";
+                newBackend = Backend::EPOLL;
+                result = false;
+            }
+        }
+
+        if (newBackend == Backend::EPOLL)
+        {
+            epollFd = epoll_create1(EPOLL_CLOEXEC);
 
-                pollFds.push_back(pollFd);
+            if (epollFd == -1)
+            {
+                int error = getLastError();
+                Log(Log::Level::WARN) << "Failed to create epoll instance, falling back to poll, error: " << error;
+                result = false;
+            }
+            else
+            {
+                backend = Backend::EPOLL;
             }
         }
 
-        if (!pollFds.empty())
+        for (const auto& socketFd : socketFds)
         {
-#ifdef _WIN32
-            if (WSAPoll(pollFds.data(), static_cast<ULONG>(pollFds.size()), 0) < 0)
+            Socket* socket = socketFd.second;
+#ifdef HAVE_IO_URING
+            // the sends of the closed ring are gone
+            socket->ringSendId = 0;
+#endif
+            socket->writeInterest = socket->connecting || !socket->outData.empty();
+            watchSocketFd(*socket);
+        }
+
+        if (wakeupReadFd != -1) watchFd(wakeupReadFd, false);
+
+        return result;
 #else
-            if (poll(pollFds.data(), static_cast<nfds_t>(pollFds.size()), 0) < 0)
+        if (newBackend != Backend::POLL)
+        {
+            Log(Log::Level::WARN) << "Only poll is available, falling back to it";
+            return false;
+        }
+
+        return true;
 #endif
+    }
+
+    bool Network::setWakeupCallback(const std::function<void()>& newWakeupCallback)
+    {
+        wakeupCallback = newWakeupCallback;
+
+#ifdef _WIN32
+        Log(Log::Level::ERR) << "Wakeup is not supported on Windows";
+        return false;
+#else
+        if (wakeupReadFd != -1) return true;
+
+#ifdef __linux__
+        wakeupReadFd = wakeupWriteFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        if (wakeupReadFd == -1)
+        {
+            int error = getLastError();
+            Log(Log::Level::ERR) << "Failed to create eventfd, error: " << error;
+            return false;
+        }
+
+        watchFd(wakeupReadFd, false);
+#else
+        int fds[2];
+
+        if (pipe(fds) != 0)
+        {
+            int error = getLastError();
+            Log(Log::Level::ERR) << "Failed to create pipe, error: " << error;
+            return false;
+        }
+
+        wakeupReadFd = fds[0];
+        wakeupWriteFd = fds[1];
+
+        for (int fd : fds)
+        {
+            int flags = fcntl(fd, F_GETFL, 0);
+            if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0)
             {
                 int error = getLastError();
-                Log(Log::Level::ERR) << "Poll failed, error: " << error;
+                Log(Log::Level::ERR) << "Failed to set pipe to non-blocking, error: " << error;
                 return false;
             }
+        }
+#endif
+
+        return true;
+#endif
+    }
+
+    void Network::wakeup()
+    {
+#ifndef _WIN32
+        if (wakeupWriteFd == -1) return;
 
-            for (pollfd& pollFd : pollFds)
+        uint64_t value = 1;
+
+        // the descriptor is non-blocking, a full counter or pipe means that a wakeup is already pending
+#ifdef __linux__
+        if (::write(wakeupWriteFd, &value, sizeof(value)) < 0)
+#else
+        if (::write(wakeupWriteFd, &value, 1) < 0)
+#endif
+        {
+            int error = getLastError();
+            if (error != EAGAIN && error != EWOULDBLOCK)
             {
-                for (Socket* deleteSocket : socketDeleteSet)
+                Log(Log::Level::ERR) << "Failed to wake up network, error: " << error;
+            }
+        }
+#endif
+    }
+
+    void Network::handleWakeup()
+    {
+#ifndef _WIN32
+        uint64_t buffer[8];
+
+        while (::read(wakeupReadFd, buffer, sizeof(buffer)) > 0)
+        {
+        }
+#endif
+
+        if (wakeupCallback) wakeupCallback();
+    }
+
+    uint64_t Network::getTicks() const
+    {
+        auto diff = std::chrono::steady_clock::now() - startTime;
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(diff).count());
+    }
+
+    void Network::addTimer(Timer& timer)
+    {
+        insertTimer(timer);
+        timer.active = true;
+    }
+
+    void Network::removeTimer(Timer& timer)
+    {
+        eraseTimer(timer);
+        timer.active = false;
+    }
+
+    void Network::insertTimer(Timer& timer)
+    {
+        // timers that are already due go to the slot that is processed next
+        uint64_t expires = std::max(timer.expires, timerTick);
+        uint64_t diff = expires - timerTick;
+
+        uint32_t level = 0;
+
+        while (level < TIMER_LEVELS - 1 &&
+               diff >= (static_cast<uint64_t>(1) << (TIMER_SLOT_BITS * (level + 1))))
+        {
+            ++level;
+        }
+
+        // timers beyond the range of the wheel wait in the top level and get rescheduled when it cascades
+        uint64_t maxDiff = (static_cast<uint64_t>(1) << (TIMER_SLOT_BITS * TIMER_LEVELS)) - 1;
+        if (diff > maxDiff) expires = timerTick + maxDiff;
+
+        timer.level = level;
+        timer.slot = static_cast<uint32_t>(expires >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1);
+
+        TimerNode& head = timerSlots[timer.level][timer.slot];
+        timer.previous = head.previous;
+        timer.next = &head;
+        head.previous->next = &timer;
+        head.previous = &timer;
+
+        timerSlotMasks[timer.level] |= static_cast<uint64_t>(1) << timer.slot;
+        ++timerCount;
+    }
+
+    void Network::eraseTimer(Timer& timer)
+    {
+        timer.previous->next = timer.next;
+        timer.next->previous = timer.previous;
+        timer.previous = &timer;
+        timer.next = &timer;
+
+        TimerNode& head = timerSlots[timer.level][timer.slot];
+        if (head.next == &head)
+        {
+            timerSlotMasks[timer.level] &= ~(static_cast<uint64_t>(1) << timer.slot);
+        }
+
+        --timerCount;
+    }
+
+    void Network::cascadeTimers(uint32_t level, uint32_t slot)
+    {
+        TimerNode& head = timerSlots[level][slot];
+
+        while (head.next != &head)
+        {
+            Timer* timer = static_cast<Timer*>(head.next);
+            eraseTimer(*timer);
+            insertTimer(*timer);
+        }
+    }
+
+    static inline uint32_t findFirstSlot(uint64_t mask)
+    {
+#if defined(_MSC_VER)
+        unsigned long result;
+        _BitScanForward64(&result, mask);
+        return static_cast<uint32_t>(result);
+#else
+        return static_cast<uint32_t>(__builtin_ctzll(mask));
+#endif
+    }
+
+    uint64_t Network::getNextTimerTick() const
+    {
+        uint64_t result = std::numeric_limits<uint64_t>::max();
+
+        for (uint32_t level = 0; level < TIMER_LEVELS; ++level)
+        {
+            uint64_t mask = timerSlotMasks[level];
+            if (!mask) continue;
+
+            // slots of the upper levels are processed when they cascade, which happens at the start of their range
+            uint32_t shift = TIMER_SLOT_BITS * level;
+            uint64_t start = ((timerTick + (static_cast<uint64_t>(1) << shift) - 1) >> shift) << shift;
+            uint32_t first = static_cast<uint32_t>(start >> shift) & (TIMER_SLOTS - 1);
+
+            uint64_t rotated = first ? ((mask >> first) | (mask << (TIMER_SLOTS - first))) : mask;
+            uint64_t tick = start + (static_cast<uint64_t>(findFirstSlot(rotated)) << shift);
+
+            if (tick < result) result = tick;
+        }
+
+        return result;
+    }
+
+    int Network::getTimeout() const
+    {
+        if (!timerCount) return -1;
+
+        uint64_t nextTick = getNextTimerTick();
+        uint64_t currentTick = getTicks();
+
+        if (nextTick <= currentTick) return 0;
+
+        uint64_t diff = nextTick - currentTick;
+        return (diff > static_cast<uint64_t>(std::numeric_limits<int>::max())) ? std::numeric_limits<int>::max() : static_cast<int>(diff);
+    }
+
+    void Network::updateTimers()
+    {
+        uint64_t currentTick = getTicks();
+
+        while (timerTick <= currentTick)
+        {
+            // skip the ticks that have nothing to do
+            uint64_t nextTick = timerCount ? getNextTimerTick() : std::numeric_limits<uint64_t>::max();
+
+            if (nextTick > currentTick)
+            {
+                timerTick = currentTick + 1;
+                break;
+            }
+
+            timerTick = nextTick;
+
+            for (uint32_t level = 1; level < TIMER_LEVELS; ++level)
+            {
+                uint32_t shift = TIMER_SLOT_BITS * level;
+                if (timerTick & ((static_cast<uint64_t>(1) << shift) - 1)) break;
+
+                cascadeTimers(level, static_cast<uint32_t>(timerTick >> shift) & (TIMER_SLOTS - 1));
+            }
+
+            // move the expired timers to a separate list, so that the timers started by the callbacks wait for the next tick
+            TimerNode& head = timerSlots[0][timerTick & (TIMER_SLOTS - 1)];
+            TimerNode expired;
+
+            if (head.next != &head)
+            {
+                expired.next = head.next;
+                expired.previous = head.previous;
+                expired.next->previous = &expired;
+                expired.previous->next = &expired;
+                head.next = &head;
+                head.previous = &head;
+                timerSlotMasks[0] &= ~(static_cast<uint64_t>(1) << (timerTick & (TIMER_SLOTS - 1)));
+            }
+
+            uint64_t tick = timerTick++;
+
+            while (expired.next != &expired)
+            {
+                Timer* timer = static_cast<Timer*>(expired.next);
+                eraseTimer(*timer);
+                timer->active = false;
+
+                if (timer->repeat)
                 {
-                    auto i = std::find(sockets.begin(), sockets.end(), deleteSocket);
+                    timer->expires = tick + std::max(timer->interval, static_cast<uint64_t>(1));
+                    addTimer(*timer);
+                }
+
+                // the callback can restart or delete the timer
+                auto callback = timer->callback;
+                if (callback) callback(*timer);
+            }
+        }
+    }
+
+    bool Network::pollSockets(int timeout)
+    {
+        std::vector<pollfd> pollFds;
+        pollFds.reserve(socketFds.size());
+
+        for (const auto& socketFd : socketFds)
+        {
+            Socket* socket = socketFd.second;
+
+            pollfd pollFd;
+            pollFd.fd = socketFd.first;
+            pollFd.events = POLLIN;
+            pollFd.revents = 0;
+
+            // a connected socket is almost always writable, so only wait for it if there is something to write
+            if (socket->writeInterest)
+            {
+                pollFd.events |= POLLOUT;
+            }
+
+            pollFds.push_back(pollFd);
+        }
+
+#ifndef _WIN32
+        if (wakeupReadFd != -1)
+        {
+            pollfd pollFd;
+            pollFd.fd = wakeupReadFd;
+            pollFd.events = POLLIN;
+            pollFd.revents = 0;
+
+            pollFds.push_back(pollFd);
+        }
+#endif
+
+#ifdef _WIN32
+        if (WSAPoll(pollFds.data(), static_cast<ULONG>(pollFds.size()), timeout) < 0)
+#else
+        if (poll(pollFds.data(), static_cast<nfds_t>(pollFds.size()), timeout) < 0)
+#endif
+        {
+            int error = getLastError();
+
+            if (error == EINTR) return true;
+
+            Log(Log::Level::ERR) << "Poll failed, error: " << error;
+            return false;
+        }
+
+        eventTime = std::chrono::steady_clock::now();
+
+        for (const pollfd& pollFd : pollFds)
+        {
+            if (!pollFd.revents) continue;
+
+#ifndef _WIN32
+            if (pollFd.fd == wakeupReadFd)
+            {
+                handleWakeup();
+                continue;
+            }
+#endif
+
+            // the socket could have been closed or deleted by a previous callback
+            auto i = socketFds.find(pollFd.fd);
+            if (i == socketFds.end()) continue;
+
+            if (pollFd.revents & POLLIN)
+            {
+                i->second->read();
+            }
+
+            if (pollFd.revents & POLLOUT)
+            {
+                i = socketFds.find(pollFd.fd);
+                if (i != socketFds.end()) i->second->write();
+            }
+        }
+
+        return true;
+    }
+
+#ifdef HAVE_IO_URING
+    bool Network::ringSockets(int timeout)
+    {
+        // the completions that were reaped while waiting for a send are handled without waiting
+        if (!ring.wait(ringDeferredCompletions.empty() ? timeout : 0)) return false;
+
+        eventTime = std::chrono::steady_clock::now();
 
-                    if (i != sockets.end())
-                    {
-                        sockets.erase(i);
-                    }
+        // the callbacks can queue new entries, so the completions are copied first
+        ring.getCompletions(ringCompletions);
+
+        if (!ringDeferredCompletions.empty())
+        {
+            ringCompletions.insert(ringCompletions.begin(), ringDeferredCompletions.begin(), ringDeferredCompletions.end());
+            ringDeferredCompletions.clear();
+        }
+
+        for (const io_uring_cqe& completion : ringCompletions)
+        {
+            // updates and removals
+            if (completion.user_data == 0) continue;
+
+            uint64_t kind = completion.user_data & RING_KIND_MASK;
+
+            if (kind == RING_SEND)
+            {
+                handleRingSend(completion);
+                continue;
+            }
+            else if (kind == RING_ACCEPT)
+            {
+                handleRingAccept(completion);
+                continue;
+            }
+
+            int fd = static_cast<int>(completion.user_data & 0xFFFFFFFF);
+
+            // the descriptor could have been removed or reused after the poll was queued
+            auto p = ringPolls.find(fd);
+            if (p == ringPolls.end() || p->second != completion.user_data) continue;
+
+            if (completion.res < 0)
+            {
+                int error = -completion.res;
+                auto i = socketFds.find(fd);
+
+                // a connection that is not polled any more would never be read again
+                if (i != socketFds.end() && (i->second->connecting || (i->second->ready && !i->second->accepting)))
+                {
+                    Log(Log::Level::ERR) << "Poll of descriptor " << fd << " failed, error: " << error << ", disconnecting";
+                    i->second->disconnected();
                 }
+                else
+                {
+                    Log(Log::Level::ERR) << "Poll of descriptor " << fd << " failed, error: " << error << ", polling again";
+                    bool writeInterest = (i != socketFds.end() && i->second->writeInterest);
+                    ring.addPoll(fd, POLLIN | (writeInterest ? POLLOUT : 0), completion.user_data);
+                }
+                continue;
+            }
+
+            uint32_t events = static_cast<uint32_t>(completion.res);
+
+            if (fd == wakeupReadFd)
+            {
+                ring.addPoll(fd, POLLIN, completion.user_data);
+                handleWakeup();
+                continue;
+            }
+
+            auto i = socketFds.find(fd);
+            if (i == socketFds.end()) continue;
+
+            // queued again before the callbacks, so that they can update or remove it
+            ring.addPoll(fd, POLLIN | (i->second->writeInterest ? POLLOUT : 0), completion.user_data);
+
+            if (events & (POLLIN | POLLERR | POLLHUP))
+            {
+                i->second->read();
+            }
+
+            if (events & POLLOUT)
+            {
+                i = socketFds.find(fd);
+                if (i != socketFds.end()) i->second->write();
+            }
+        }
+
+        return true;
+    }
+
+    uint64_t Network::getRingUserData(int fd, uint64_t kind)
+    {
+        ringGeneration = (ringGeneration + 1) & RING_GENERATION_MASK;
+        if (ringGeneration == 0) ringGeneration = 1;
+
+        return kind | (static_cast<uint64_t>(ringGeneration) << 32) | static_cast<uint32_t>(fd);
+    }
+
+    void Network::handleRingAccept(const io_uring_cqe& completion)
+    {
+        int fd = static_cast<int>(completion.user_data & 0xFFFFFFFF);
+
+        auto p = ringPolls.find(fd);
+        bool active = (p != ringPolls.end() && p->second == completion.user_data);
+
+        if (completion.res >= 0)
+        {
+            int clientFd = completion.res;
+            auto i = socketFds.find(fd);
+
+            // the client was accepted before the accept was cancelled
+            if (!active || i == socketFds.end())
+            {
+                ::close(clientFd);
+                return;
+            }
+
+            sockaddr_in address;
+            socklen_t addressLength = sizeof(address);
+
+            if (getpeername(clientFd, reinterpret_cast<sockaddr*>(&address), &addressLength) != 0)
+            {
+                int error = getLastError();
+                Log(Log::Level::ERR) << "Failed to get the address of the accepted client, error: " << error;
+                ::close(clientFd);
+            }
+            else
+            {
+                i->second->acceptFd(clientFd, address.sin_addr.s_addr, ntohs(address.sin_port));
+            }
+        }
+        else if (!active)
+        {
+            // cancelled
+            return;
+        }
+        else if (completion.res == -EINVAL)
+        {
+            // multishot accept is available from Linux 5.19, the older kernels poll the listening sockets
+            Log(Log::Level::WARN) << "Multishot accept is not supported, polling the listening sockets";
+            ringMultishotAccept = false;
+            ringPolls.erase(p);
+
+            auto i = socketFds.find(fd);
+            if (i != socketFds.end()) watchFd(fd, i->second->writeInterest);
+            return;
+        }
+        else
+        {
+            Log(Log::Level::ERR) << "Failed to accept client, error: " << -completion.res;
+        }
+
+        // the kernel ends a multishot accept after an error, so it is queued again while the socket listens
+        if (!(completion.flags & IORING_CQE_F_MORE))
+        {
+            p = ringPolls.find(fd);
+            if (p != ringPolls.end() && p->second == completion.user_data) ring.addAccept(fd, completion.user_data);
+        }
+    }
+
+    uint64_t Network::addRingSend(socket_t socketFd, std::unique_ptr<RingSend>&& send)
+    {
+        uint64_t userData = getRingUserData(socketFd, RING_SEND);
 
-                socketDeleteSet.clear();
+        memset(&send->message, 0, sizeof(send->message));
+        send->message.msg_iov = send->segments.data();
+        send->message.msg_iovlen = send->segments.size();
 
-                auto i = std::find_if(sockets.begin(), sockets.end(), [&pollFd](Socket* socket) {
-                    return socket->socketFd == pollFd.fd;
-                });
+        // submitted with the next wait, together with the sends of the other sockets
+        if (!ring.addSendMsg(socketFd, &send->message, MSG_NOSIGNAL, userData)) return 0;
+
+        ringSends[userData] = std::move(send);
+
+        return userData;
+    }
+
+    void Network::handleRingSend(const io_uring_cqe& completion)
+    {
+        auto s = ringSends.find(completion.user_data);
+        if (s == ringSends.end()) return;
+
+        // the socket keeps the buffers of the data that was not sent
+        std::unique_ptr<RingSend> send = std::move(s->second);
+        ringSends.erase(s);
+
+        int fd = static_cast<int>(completion.user_data & 0xFFFFFFFF);
+
+        // the socket could have been closed, or its descriptor reused, after the send was queued
+        auto i = socketFds.find(fd);
+        if (i == socketFds.end() || i->second->ringSendId != completion.user_data) return;
+
+        i->second->ringSendCompleted(completion.res, send->size);
+    }
+
+    int Network::waitRingSend(uint64_t userData)
+    {
+        // the send is issued when it is submitted, and a send to a non-blocking socket does not wait for the peer
+        std::vector<io_uring_cqe> completions;
+
+        for (;;)
+        {
+            ring.getCompletions(completions);
 
-                if (i != sockets.end())
+            bool found = false;
+            int result = 0;
+
+            for (const io_uring_cqe& completion : completions)
+            {
+                if (completion.user_data == userData)
+                {
+                    found = true;
+                    result = completion.res;
+                }
+                else
                 {
-                    Socket* socket = *i;
-
-                    if (pollFd.revents & POLLIN)
-                    {
-                        socket->read();
-                    }
-
-                    if (pollFd.revents & POLLOUT)
-                    {
-                        socket->write();
-                    }
-                    
-                    socket->update(delta);
+                    ringDeferredCompletions.push_back(completion);
                 }
             }
+
+            if (found)
+            {
+                ringSends.erase(userData);
+                return result;
+            }
+
+            if (!ring.wait(-1)) return -EIO;
+        }
+    }
+#endif
+
+    void Network::addFlush(Socket& socket)
+    {
+        flushFds.push_back(socket.socketFd);
+    }
+
+    void Network::lingerSocketFd(socket_t socketFd, std::deque<Socket::ZeroCopySend>&& sends)
+    {
+        LingeringSocket lingeringSocket;
+        lingeringSocket.socketFd = socketFd;
+        lingeringSocket.sends = std::move(sends);
+        lingeringSockets.push_back(std::move(lingeringSocket));
+    }
+
+    void Network::updateLingeringSockets()
+    {
+        for (auto i = lingeringSockets.begin(); i != lingeringSockets.end();)
+        {
+            bool copied = false;
+            Socket::readZeroCopyCompletions(i->socketFd, i->sends, copied);
+
+            if (i->sends.empty())
+            {
+                // the kernel does not read the buffers any more, so they can be released with the descriptor
+#ifdef _WIN32
+                closesocket(i->socketFd);
+#else
+                ::close(i->socketFd);
+#endif
+                i = lingeringSockets.erase(i);
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+
+    void Network::flushSockets()
+    {
+        // write callbacks can queue more data
+        while (!flushFds.empty())
+        {
+            flushingFds.swap(flushFds);
+
+            for (socket_t socketFd : flushingFds)
+            {
+                // the socket could have been closed or deleted after it queued the data
+                auto i = socketFds.find(socketFd);
+                if (i == socketFds.end()) continue;
+
+                Socket* socket = i->second;
+                if (!socket->flushPending) continue;
+
+                socket->flushPending = false;
+                socket->writeData();
+            }
+
+            flushingFds.clear();
+        }
+    }
+
+#ifdef __linux__
+    bool Network::epollSockets(int timeout)
+    {
+        if (epollEvents.size() < socketFds.size() + 1)
+        {
+            epollEvents.resize(socketFds.size() + 1);
+        }
+
+        int count = epoll_wait(epollFd, epollEvents.data(), static_cast<int>(epollEvents.size()), timeout);
+
+        if (count < 0)
+        {
+            int error = getLastError();
+
+            if (error == EINTR) return true;
+
+            Log(Log::Level::ERR) << "Epoll failed, error: " << error;
+            return false;
+        }
+
+        eventTime = std::chrono::steady_clock::now();
+
+        for (int e = 0; e < count; ++e)
+        {
+            const epoll_event& event = epollEvents[static_cast<size_t>(e)];
+
+            if (event.data.fd == wakeupReadFd)
+            {
+                handleWakeup();
+                continue;
+            }
+
+            // the socket could have been closed or deleted by a previous callback
+            auto i = socketFds.find(event.data.fd);
+            if (i == socketFds.end()) continue;
+
+            // let read report errors and hang-ups, like poll does with POLLIN
+            if (event.events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+            {
+                i->second->read();
+            }
+
+            if (event.events & EPOLLOUT)
+            {
+                i = socketFds.find(event.data.fd);
+                if (i != socketFds.end()) i->second->write();
+            }
         }
 
         return true;
     }
+#endif
+
+    void Network::addSocketFd(Socket& socket)
+    {
+        auto i = socketFds.find(socket.socketFd);
+
+        // the descriptor was moved to a different socket object
+        if (i != socketFds.end())
+        {
+            i->second = &socket;
+            return;
+        }
+
+        socketFds[socket.socketFd] = &socket;
+        socket.writeInterest = socket.connecting || !socket.outData.empty();
+
+#ifdef __linux__
+        watchSocketFd(socket);
+#endif
+    }
+
+    void Network::updateSocketFd(Socket& socket)
+    {
+#ifdef __linux__
+#ifdef HAVE_IO_URING
+        // the socket started listening after it was registered, so its poll is replaced with an accept
+        if (backend == Backend::IO_URING && socket.accepting && ringMultishotAccept)
+        {
+            auto i = ringPolls.find(socket.socketFd);
+
+            if (i == ringPolls.end() || (i->second & RING_KIND_MASK) == RING_POLL)
+            {
+                unwatchFd(socket.socketFd);
+                watchSocketFd(socket);
+            }
+            return;
+        }
+#endif
+        updateFd(socket.socketFd, socket.writeInterest);
+#else
+        (void)socket;
+#endif
+    }
 
-    void Network::addSocket(Socket& socket)
+    void Network::removeSocketFd(Socket& socket)
     {
-        socketAddSet.insert(&socket);
+        // the entry in the flush list can not find the socket anymore
+        socket.flushPending = false;
+
+#ifdef HAVE_IO_URING
+        // the queued send refers to the descriptor, so it is issued before the descriptor can be closed or reused
+        if (socket.ringSendId != 0)
+        {
+            ring.submit();
+            socket.ringSendId = 0;
+        }
+#endif
 
-        auto setIterator = socketDeleteSet.find(&socket);
+        auto i = socketFds.find(socket.socketFd);
 
-        if (setIterator != socketDeleteSet.end())
+        if (i != socketFds.end() && i->second == &socket)
+        {
+            socketFds.erase(i);
+
+#ifdef __linux__
+            unwatchFd(socket.socketFd);
+#endif
+        }
+    }
+
+#ifdef __linux__
+    void Network::watchSocketFd(Socket& socket)
+    {
+#ifdef HAVE_IO_URING
+        // the listening sockets accept the clients in the kernel
+        if (backend == Backend::IO_URING && socket.accepting && ringMultishotAccept)
         {
-            socketDeleteSet.erase(setIterator);
+            uint64_t userData = getRingUserData(socket.socketFd, RING_ACCEPT);
+
+            if (ring.addAccept(socket.socketFd, userData))
+            {
+                ringPolls[socket.socketFd] = userData;
+                return;
+            }
+
+            ringMultishotAccept = false;
         }
+#endif
+
+        watchFd(socket.socketFd, socket.writeInterest);
     }
 
-    void Network::removeSocket(Socket& socket)
+    void Network::watchFd(int fd, bool writeInterest)
     {
-        socketDeleteSet.insert(&socket);
+#ifdef HAVE_IO_URING
+        if (backend == Backend::IO_URING)
+        {
+            uint64_t userData = getRingUserData(fd, RING_POLL);
+            ringPolls[fd] = userData;
 
-        auto setIterator = socketAddSet.find(&socket);
+            // submitted with the next wait
+            ring.addPoll(fd, POLLIN | (writeInterest ? POLLOUT : 0), userData);
+            return;
+        }
+#endif
 
-        if (setIterator != socketAddSet.end())
+        if (epollFd != -1)
         {
-            socketAddSet.erase(setIterator);
+            epoll_event event;
+            event.events = EPOLLIN | (writeInterest ? EPOLLOUT : 0);
+            event.data.u64 = 0;
+            event.data.fd = fd;
+
+            if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0)
+            {
+                int error = getLastError();
+                Log(Log::Level::ERR) << "Failed to add descriptor to epoll, error: " << error;
+            }
         }
     }
+
+    void Network::updateFd(int fd, bool writeInterest)
+    {
+#ifdef HAVE_IO_URING
+        if (backend == Backend::IO_URING)
+        {
+            // a poll that still waits for writing completes once and is queued again with the current interest
+            if (!writeInterest) return;
+
+            auto i = ringPolls.find(fd);
+            if (i != ringPolls.end() && (i->second & RING_KIND_MASK) == RING_POLL) ring.updatePoll(i->second, POLLIN | POLLOUT);
+            return;
+        }
+#endif
+
+        if (epollFd != -1)
+        {
+            epoll_event event;
+            event.events = EPOLLIN | (writeInterest ? EPOLLOUT : 0);
+            event.data.u64 = 0;
+            event.data.fd = fd;
+
+            if (epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event) != 0)
+            {
+                int error = getLastError();
+                Log(Log::Level::ERR) << "Failed to modify epoll events, error: " << error;
+            }
+        }
+    }
+
+    void Network::unwatchFd(int fd)
+    {
+#ifdef HAVE_IO_URING
+        if (backend == Backend::IO_URING)
+        {
+            auto i = ringPolls.find(fd);
+
+            if (i != ringPolls.end())
+            {
+                if ((i->second & RING_KIND_MASK) == RING_ACCEPT) ring.cancel(i->second);
+                else ring.removePoll(i->second);
+                ringPolls.erase(i);
+
+                // the queued poll or accept holds a reference to the file, so it is removed before the descriptor is closed
+                ring.submit();
+            }
+            return;
+        }
+#endif
+
+        if (epollFd != -1)
+        {
+            epoll_event event;
+            event.events = 0;
+            event.data.u64 = 0;
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, &event);
+        }
+    }
+#endif
 }
@@ -10,16 +10,37 @@
 #include <memory>
 #include <string>
 #include <set>
+#include <unordered_map>
 #include <chrono>
+#include <deque>
+#include <functional>
+#ifdef __linux__
+#  include <sys/epoll.h>
+#endif
+#include "IoRing.hpp"
+#ifdef HAVE_IO_URING
+#  include <sys/socket.h>
+#  include <sys/uio.h>
+#endif
 #include "Socket.hpp"
+#include "Timer.hpp"
 
 namespace relay
 {
     class Network
     {
         friend Socket;
+        friend Timer;
     public:
+        enum class Backend
+        {
+            POLL,
+            EPOLL, // Linux only
+            IO_URING // Linux 5.13 or newer
+        };
+
         Network();
+        ~Network();
 
         Network(const Network&) = delete;
         Network& operator=(const Network&) = delete;
@@ -29,14 +50,116 @@ namespace relay
 
         bool update();
 
+        // falls back to epoll and then to poll if the backend is not available
+        bool setBackend(Backend newBackend);
+        Backend getBackend() const { return backend; }
+
+        // milliseconds since the creation of the network
+        uint64_t getTicks() const;
+
+        // interrupts the wait of update, can be called from any thread
+        bool setWakeupCallback(const std::function<void()>& newWakeupCallback);
+        void wakeup();
+
     protected:
-        void addSocket(Socket& socket);
-        void removeSocket(Socket& socket);
+        void addSocketFd(Socket& socket);
+        void removeSocketFd(Socket& socket);
+        void updateSocketFd(Socket& socket);
+        void addFlush(Socket& socket);
+        void flushSockets();
+        // keeps the descriptor of a closed socket open until the kernel has completed its zero copy sends
+        void lingerSocketFd(socket_t socketFd, std::deque<Socket::ZeroCopySend>&& sends);
+        void updateLingeringSockets();
+
+        void addTimer(Timer& timer);
+        void removeTimer(Timer& timer);
+        void insertTimer(Timer& timer);
+        void eraseTimer(Timer& timer);
+        void cascadeTimers(uint32_t level, uint32_t slot);
+        uint64_t getNextTimerTick() const;
+        int getTimeout() const;
+        void updateTimers();
+
+        bool pollSockets(int timeout);
+#ifdef __linux__
+        bool epollSockets(int timeout);
+        // registers the descriptor with the epoll or io_uring backend
+        void watchFd(int fd, bool writeInterest);
+        void updateFd(int fd, bool writeInterest);
+        void unwatchFd(int fd);
+        // listening sockets accept with the io_uring backend instead of waiting for readiness
+        void watchSocketFd(Socket& socket);
+#endif
+#ifdef HAVE_IO_URING
+        bool ringSockets(int timeout);
+        uint64_t getRingUserData(int fd, uint64_t kind);
+        void handleRingAccept(const io_uring_cqe& completion);
+        void handleRingSend(const io_uring_cqe& completion);
+
+        // a sendmsg of the queued data of a socket, kept until it completes even if the socket is closed
+        struct RingSend
+        {
+            msghdr message;
+            std::vector<iovec> segments;
+            std::vector<Buffer> buffers;
+            size_t size = 0;
+        };
+        // returns the user data of the send or 0 if it could not be queued
+        uint64_t addRingSend(socket_t socketFd, std::unique_ptr<RingSend>&& send);
+        // waits for the completion of the send and returns its result, the other completions are handled later
+        int waitRingSend(uint64_t userData);
+#endif
+        void handleWakeup();
+
+        // index of the sockets that have a valid file descriptor
+        std::unordered_map<socket_t, Socket*> socketFds;
+        // sockets that have data queued during the current loop iteration
+        std::vector<socket_t> flushFds;
+        std::vector<socket_t> flushingFds;
+
+        struct LingeringSocket
+        {
+            socket_t socketFd;
+            std::deque<Socket::ZeroCopySend> sends;
+        };
+        std::vector<LingeringSocket> lingeringSockets;
+        uint64_t lingerCheckTick = 0;
+
+        // hierarchical timer wheel, each level has 64 slots of 64 times the resolution of the previous level
+        static const uint32_t TIMER_LEVELS = 4;
+        static const uint32_t TIMER_SLOT_BITS = 6;
+        static const uint32_t TIMER_SLOTS = 1 << TIMER_SLOT_BITS;
+
+        std::chrono::steady_clock::time_point startTime;
+        // when the wait of the current iteration ended
+        std::chrono::steady_clock::time_point eventTime;
+        uint64_t timerTick = 0; // next tick to process
+        uint64_t timerCount = 0;
+        TimerNode timerSlots[TIMER_LEVELS][TIMER_SLOTS];
+        uint64_t timerSlotMasks[TIMER_LEVELS] = {0};
 
-        std::vector<Socket*> sockets;
-        std::set<Socket*> socketAddSet;
-        std::set<Socket*> socketDeleteSet;
+        Backend backend = Backend::POLL;
+#ifdef __linux__
+        int epollFd = -1;
+        std::vector<epoll_event> epollEvents;
+#endif
+#ifdef HAVE_IO_URING
+        IoRing ring;
+        // user data of the queued poll or multishot accept of each descriptor,
+        // the two upper bits tell the kind of the request and the rest of the upper half tells apart the reused descriptors
+        std::unordered_map<int, uint64_t> ringPolls;
+        uint32_t ringGeneration = 0;
+        bool ringMultishotAccept = true;
+        std::unordered_map<uint64_t, std::unique_ptr<RingSend>> ringSends;
+        std::vector<io_uring_cqe> ringCompletions;
+        std::vector<io_uring_cqe> ringDeferredCompletions;
+#endif
 
-        std::chrono::steady_clock::time_point previousTime;
+        std::function<void()> wakeupCallback;
+#ifndef _WIN32
+        // eventfd on Linux (both ends are the same descriptor), pipe elsewhere
+        int wakeupReadFd = -1;
+        int wakeupWriteFd = -1;
+#endif
     };
 }
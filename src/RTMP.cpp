@@ -4,6 +4,7 @@
 
 #include <iostream>
 #include <algorithm>
+#include <iterator>
 #include <cmath>
 #include "Log.hpp"
 #include "RTMP.hpp"
@@ -35,16 +36,95 @@ namespace relay
             };
         }
 
-        static uint32_t decodeHeader(const std::vector<uint8_t>& data, uint32_t offset, Header& header, std::map<uint32_t, rtmp::Header>& previousPackets)
+        const Header& ChunkStreams::get(uint32_t channel) const
+        {
+            if (channel < DENSE_CHANNELS) return dense[channel].header;
+
+            static const Header empty;
+            auto i = overflow.find(channel);
+
+            return (i == overflow.end()) ? empty : i->second.header;
+        }
+
+        ChunkStreams::Entry& ChunkStreams::getEntry(uint32_t channel)
+        {
+            if (channel < DENSE_CHANNELS) return dense[channel];
+
+            return overflow[channel];
+        }
+
+        void ChunkStreams::set(uint32_t channel, const Header& header)
+        {
+            getEntry(channel).header = header;
+        }
+
+        ChunkStreams::Message& ChunkStreams::getMessage(uint32_t channel)
+        {
+            return getEntry(channel).message;
+        }
+
+        void ChunkStreams::clear()
+        {
+            std::fill(std::begin(dense), std::end(dense), Entry());
+            overflow.clear();
+        }
+
+        // the fields that a header of the type carries, followed by the resolved timestamp
+        static void logHeader(const Header& header, bool extended, uint64_t extendedTimestamp)
+        {
+            Log log(Log::Level::ALL);
+            log << "Header type: ";
+
+            switch (header.type)
+            {
+                case Header::Type::TWELVE_BYTE: log << "TWELVE_BYTE"; break;
+                case Header::Type::EIGHT_BYTE: log << "EIGHT_BYTE"; break;
+                case Header::Type::FOUR_BYTE: log << "FOUR_BYTE"; break;
+                case Header::Type::ONE_BYTE: log << "ONE_BYTE"; break;
+                default: log << "invalid header type"; break;
+            };
+
+            log << "(" << static_cast<uint32_t>(header.type) << "), channel: " << static_cast<uint32_t>(header.channel);
+
+            if (header.type != Header::Type::ONE_BYTE)
+            {
+                log << ", ts: " << header.ts;
+
+                if (header.ts == 0xffffff)
+                {
+                    log << " (extended)";
+                }
+
+                if (header.type != Header::Type::FOUR_BYTE)
+                {
+                    log << ", data length: " << header.length;
+                    log << ", message type: " << messageTypeToString(header.messageType) << "(" << static_cast<uint32_t>(header.messageType) << ")";
+
+                    if (header.type != Header::Type::EIGHT_BYTE)
+                    {
+                        log << ", message stream ID: " << header.messageStreamId;
+                    }
+                }
+            }
+
+            if (extended)
+            {
+                log << ", extended timestamp: " << extendedTimestamp;
+            }
+
+            log << ", final timestamp: " << header.timestamp;
+        }
+
+        static uint32_t decodeHeader(const uint8_t* data, uint32_t dataSize, uint32_t offset, Header& header, ChunkStreams& previousPackets)
         {
             uint32_t originalOffset = offset;
 
-            if (data.size() - offset < 1)
+            if (dataSize - offset < 1)
             {
                 return 0;
             }
 
-            uint8_t headerData = *(data.data() + offset);
+            uint8_t headerData = *(data + offset);
             offset += 1;
 
             header.channel = static_cast<uint32_t>(headerData & 0x3F);
@@ -53,7 +133,7 @@ namespace relay
             if (header.channel < 2)
             {
                 uint32_t newChannel;
-                uint32_t ret = decodeIntBE(data, offset, header.channel + 1, newChannel);
+                uint32_t ret = decodeIntBE(data, dataSize, offset, header.channel + 1, newChannel);
 
                 if (!ret)
                 {
@@ -65,28 +145,16 @@ namespace relay
                 header.channel = 64 + newChannel;
             }
 
-            Log log(Log::Level::ALL);
-            log << "Header type: ";
+            const Header& previousHeader = previousPackets.get(header.channel);
 
-            switch (header.type)
-            {
-                case Header::Type::TWELVE_BYTE: log << "TWELVE_BYTE"; break;
-                case Header::Type::EIGHT_BYTE: log << "EIGHT_BYTE"; break;
-                case Header::Type::FOUR_BYTE: log << "FOUR_BYTE"; break;
-                case Header::Type::ONE_BYTE: log << "ONE_BYTE"; break;
-                default: log << "invalid header type"; break;
-            };
-
-            log << "(" << static_cast<uint32_t>(header.type) << "), channel: " << static_cast<uint32_t>(header.channel);
-
-            header.length  = previousPackets[header.channel].length;
-            header.messageType  = previousPackets[header.channel].messageType;
-            header.messageStreamId = previousPackets[header.channel].messageStreamId;
-            header.ts = previousPackets[header.channel].ts;
+            header.length  = previousHeader.length;
+            header.messageType  = previousHeader.messageType;
+            header.messageStreamId = previousHeader.messageStreamId;
+            header.ts = previousHeader.ts;
 
             if (header.type != Header::Type::ONE_BYTE)
             {
-                uint32_t ret = decodeIntBE(data, offset, 3, header.ts);
+                uint32_t ret = decodeIntBE(data, dataSize, offset, 3, header.ts);
 
                 if (!ret)
                 {
@@ -95,16 +163,9 @@ namespace relay
 
                 offset += ret;
 
-                log << ", ts: " << header.ts;
-
-                if (header.ts == 0xffffff)
-                {
-                    log << " (extended)";
-                }
-
                 if (header.type != Header::Type::FOUR_BYTE)
                 {
-                    ret = decodeIntBE(data, offset, 3, header.length);
+                    ret = decodeIntBE(data, dataSize, offset, 3, header.length);
 
                     if (!ret)
                     {
@@ -113,26 +174,22 @@ namespace relay
 
                     offset += ret;
 
-                    log << ", data length: " << header.length;
-
-                    if (data.size() - offset < 1)
+                    if (dataSize - offset < 1)
                     {
                         return 0;
                     }
 
-                    header.messageType = static_cast<MessageType>(*(data.data() + offset));
+                    header.messageType = static_cast<MessageType>(*(data + offset));
                     offset += 1;
 
-                    log << ", message type: " << messageTypeToString(header.messageType) << "(" << static_cast<uint32_t>(header.messageType) << ")";
-
                     if (header.type != Header::Type::EIGHT_BYTE)
                     {
-                        if (data.size() - offset < 4)
+                        if (dataSize - offset < 4)
                         {
                             return 0;
                         }
 
-                        ret = decodeIntLE(data, offset, 4, header.messageStreamId);
+                        ret = decodeIntLE(data, dataSize, offset, 4, header.messageStreamId);
 
                         if (!ret)
                         {
@@ -140,8 +197,6 @@ namespace relay
                         }
 
                         offset += ret;
-
-                        log << ", message stream ID: " << header.messageStreamId;
                     }
                 }
             }
@@ -149,7 +204,7 @@ namespace relay
             // extended timestamp
             if (header.ts == 0xffffff)
             {
-                uint32_t ret = decodeIntBE(data, offset, 4, header.timestamp);
+                uint32_t ret = decodeIntBE(data, dataSize, offset, 4, header.timestamp);
 
                 if (!ret)
                 {
@@ -157,8 +212,6 @@ namespace relay
                 }
 
                 offset += ret;
-
-                log << ", extended timestamp: " << header.timestamp;
             }
             else
             {
@@ -168,97 +221,108 @@ namespace relay
             // relative timestamp
             if (header.type != rtmp::Header::Type::TWELVE_BYTE)
             {
-                header.timestamp += previousPackets[header.channel].timestamp;
+                header.timestamp += previousHeader.timestamp;
             }
 
-            log << ", final timestamp: " << header.timestamp;
+            if (RELAY_LOG_ENABLED(Log::Level::ALL))
+            {
+                logHeader(header, header.ts == 0xffffff, header.timestamp - ((header.type != Header::Type::TWELVE_BYTE) ? previousHeader.timestamp : 0));
+            }
 
             return offset - originalOffset;
         }
 
-        uint32_t Packet::decode(const std::vector<uint8_t>& buffer, uint32_t offset, uint32_t chunkSize, std::map<uint32_t, rtmp::Header>& previousPackets)
+        uint32_t Packet::decode(const uint8_t* buffer, uint32_t bufferSize, uint32_t offset, uint32_t chunkSize, ChunkStreams& previousPackets, bool& complete)
         {
             uint32_t originalOffset = offset;
 
-            uint32_t remainingBytes = 0;
-
-            data.clear();
-
-            auto currentPreviousPackets = previousPackets;
-
-            bool firstPacket = true;
+            complete = false;
 
-            do
+            while (!complete)
             {
                 Header header;
-                uint32_t ret = decodeHeader(buffer, offset, header, currentPreviousPackets);
+                uint32_t ret = decodeHeader(buffer, bufferSize, offset, header, previousPackets);
 
                 if (!ret)
                 {
-                    return 0;
+                    break;
                 }
 
-                offset += ret;
+                ChunkStreams::Message& message = previousPackets.getMessage(header.channel);
 
-                if (header.type == Header::Type::FOUR_BYTE ||
-                    header.type == Header::Type::EIGHT_BYTE ||
-                    header.type == Header::Type::TWELVE_BYTE)
+                // only a one byte header continues the message of the chunk stream
+                bool firstChunk = (header.type != Header::Type::ONE_BYTE || message.remainingBytes == 0);
+
+                uint32_t remainingBytes = firstChunk ? header.length : message.remainingBytes;
+                uint32_t chunkDataSize = std::min(remainingBytes, chunkSize);
+
+                // the chunk is consumed only when it is complete
+                if (ret + chunkDataSize > bufferSize - offset)
                 {
-                    currentPreviousPackets[header.channel] = header;
+                    RELAY_LOG(Log::Level::ALL) << "Not enough data to read";
+                    break;
                 }
 
-                // first header of packer
-                if (firstPacket)
+                offset += ret;
+
+                if (firstChunk)
                 {
-                    channel = header.channel;
-                    messageType = header.messageType;
-                    messageStreamId = header.messageStreamId;
-                    timestamp = header.timestamp;
+                    if (message.remainingBytes > 0)
+                    {
+                        Log(Log::Level::WARN) << "Chunk stream " << header.channel << " started a new message before the previous one was complete";
+                    }
 
-                    remainingBytes = header.length;
+                    if (header.type != Header::Type::ONE_BYTE)
+                    {
+                        previousPackets.set(header.channel, header);
+                    }
 
-                    currentPreviousPackets[header.channel].ts = header.ts;
-                    currentPreviousPackets[header.channel].timestamp = header.timestamp;
+                    Header previousHeader = previousPackets.get(header.channel);
+                    previousHeader.ts = header.ts;
+                    previousHeader.timestamp = header.timestamp;
+                    previousPackets.set(header.channel, previousHeader);
 
-                    firstPacket = false;
+                    message.header = header;
+                    message.data.clear();
+                    message.remainingBytes = header.length;
                 }
 
-                uint32_t packetSize = std::min(remainingBytes, chunkSize);
+                message.data.insert(message.data.end(), buffer + offset, buffer + offset + chunkDataSize);
+                message.remainingBytes -= chunkDataSize;
+                offset += chunkDataSize;
 
-                if (packetSize + offset > buffer.size())
+                if (message.remainingBytes == 0)
                 {
-                    Log(Log::Level::ALL) << "Not enough data to read";
-
-                    return 0;
+                    channel = message.header.channel;
+                    messageType = message.header.messageType;
+                    messageStreamId = message.header.messageStreamId;
+                    timestamp = message.header.timestamp;
+                    data = std::move(message.data);
+                    message.data = std::vector<uint8_t>();
+
+                    complete = true;
                 }
-
-                data.insert(data.end(), buffer.begin() + offset, buffer.begin() + offset + packetSize);
-
-                remainingBytes -= packetSize;
-                offset += packetSize;
             }
-            while (remainingBytes);
-
-            // store previous packet if successfully read packet
-            previousPackets = currentPreviousPackets;
 
             return offset - originalOffset;
         }
 
-        static uint32_t encodeHeader(std::vector<uint8_t>& data, Header& header, std::map<uint32_t, rtmp::Header>& previousPackets)
+        static uint32_t encodeHeader(std::vector<uint8_t>& data, Header& header, ChunkStreams& previousPackets)
         {
             uint32_t originalSize = static_cast<uint32_t>(data.size());
 
-            bool useDelta = previousPackets[header.channel].channel != Channel::NONE &&
-                previousPackets[header.channel].messageStreamId == header.messageStreamId &&
-                header.timestamp >= previousPackets[header.channel].timestamp;
+            const Header& previousHeader = previousPackets.get(header.channel);
+
+            bool useDelta = previousHeader.channel != Channel::NONE &&
+                previousHeader.messageStreamId == header.messageStreamId &&
+                header.timestamp >= previousHeader.timestamp;
 
             uint64_t timestamp = header.timestamp;
 
             // relative timestamp
             if (useDelta)
             {
-                timestamp -= previousPackets[header.channel].timestamp;
+                timestamp -= previousHeader.timestamp;
             }
 
             if (timestamp >= 0xffffff)
@@ -272,10 +336,10 @@ namespace relay
 
             if (useDelta)
             {
-                if (header.messageType == previousPackets[header.channel].messageType &&
-                    header.length == previousPackets[header.channel].length)
+                if (header.messageType == previousHeader.messageType &&
+                    header.length == previousHeader.length)
                 {
-                    if (header.timestamp == previousPackets[header.channel].timestamp)
+                    if (header.timestamp == previousHeader.timestamp)
                     {
                         header.type = rtmp::Header::Type::ONE_BYTE;
                     }
@@ -314,20 +378,6 @@ namespace relay
                 encodeIntBE(data, 2, header.channel - 64);
             }
 
-            Log log(Log::Level::ALL);
-            log << "Header type: ";
-
-            switch (header.type)
-            {
-                case Header::Type::TWELVE_BYTE: log << "TWELVE_BYTE"; break;
-                case Header::Type::EIGHT_BYTE: log << "EIGHT_BYTE"; break;
-                case Header::Type::FOUR_BYTE: log << "FOUR_BYTE"; break;
-                case Header::Type::ONE_BYTE: log << "ONE_BYTE"; break;
-                default: log << "invalid header type"; break;
-            };
-
-            log << "(" << static_cast<uint32_t>(header.type) << "), channel: " << static_cast<uint32_t>(header.channel);
-
             if (header.type != Header::Type::ONE_BYTE)
             {
                 uint32_t ret = encodeIntBE(data, 3, header.ts);
@@ -337,13 +387,6 @@ namespace relay
                     return 0;
                 }
 
-                log << ", ts: " << header.ts;
-
-                if (header.ts == 0xffffff)
-                {
-                    log << " (extended)";
-                }
-
                 if (header.type != Header::Type::FOUR_BYTE)
                 {
                     ret = encodeIntBE(data, 3, header.length);
@@ -355,9 +398,6 @@ namespace relay
 
                     data.insert(data.end(), static_cast<uint8_t>(header.messageType));
 
-                    log << ", data length: " << header.length;
-                    log << ", message type: " << messageTypeToString(header.messageType) << "(" << static_cast<uint32_t>(header.messageType) << ")";
-
                     if (header.type != Header::Type::EIGHT_BYTE)
                     {
                         ret = encodeIntLE(data, 4, header.messageStreamId);
@@ -367,12 +407,11 @@ namespace relay
                             return 0;
                         }
 
-                        log << ", message stream ID: " << header.messageStreamId;
                     }
                 }
             }
 
-            if (header.ts == 0xffffff || (header.type == Header::Type::ONE_BYTE && previousPackets[header.channel].ts == 0xffffff))
+            if (header.ts == 0xffffff || (header.type == Header::Type::ONE_BYTE && previousHeader.ts == 0xffffff))
             {
                 uint32_t ret = encodeIntBE(data, 4, timestamp);
 
@@ -380,16 +419,17 @@ namespace relay
                 {
                     return 0;
                 }
-
-                log << ", extended timestamp: " << header.timestamp;
             }
 
-            log << ", final timestamp: " << header.timestamp;
+            if (RELAY_LOG_ENABLED(Log::Level::ALL))
+            {
+                logHeader(header, header.ts == 0xffffff || (header.type == Header::Type::ONE_BYTE && previousHeader.ts == 0xffffff), header.timestamp);
+            }
 
             return static_cast<uint32_t>(data.size()) - originalSize;
         }
 
-        uint32_t Packet::encode(std::vector<uint8_t>& buffer, uint32_t chunkSize, std::map<uint32_t, rtmp::Header>& previousPackets) const
+        uint32_t Packet::encode(std::vector<uint8_t>& buffer, uint32_t chunkSize, ChunkStreams& previousPackets) const
         {
             uint32_t originalSize = static_cast<uint32_t>(buffer.size());
 
@@ -414,7 +454,7 @@ namespace relay
                     header.type == Header::Type::EIGHT_BYTE ||
                     header.type == Header::Type::TWELVE_BYTE)
                 {
-                    previousPackets[header.channel] = header;
+                    previousPackets.set(header.channel, header);
                 }
 
                 uint32_t size = std::min(remainingBytes, chunkSize);
@@ -427,5 +467,30 @@ namespace relay
 
             return static_cast<uint32_t>(buffer.size()) - originalSize;
         }
+
+        bool Packet::encodeHeaders(std::vector<uint8_t>& firstHeader, std::vector<uint8_t>& nextHeader, uint32_t length, ChunkStreams& previousPackets) const
+        {
+            Header header;
+            header.channel = channel;
+            header.messageType = messageType;
+            header.messageStreamId = messageStreamId;
+            header.timestamp = timestamp;
+            header.length = length;
+
+            if (!encodeHeader(firstHeader, header, previousPackets))
+            {
+                return false;
+            }
+
+            if (header.type == Header::Type::FOUR_BYTE ||
+                header.type == Header::Type::EIGHT_BYTE ||
+                header.type == Header::Type::TWELVE_BYTE)
+            {
+                previousPackets.set(header.channel, header);
+            }
+
+            // the following chunks repeat the first one, so they all get the same one byte header
+            return encodeHeader(nextHeader, header, previousPackets) > 0;
+        }
     }
 }
@@ -7,6 +7,7 @@
 #include <cstdint>
 #include <vector>
 #include <map>
+#include <utility>
 
 namespace relay
 {
@@ -76,6 +77,38 @@ namespace relay
             uint64_t timestamp = 0; // final timestamp (either from 3-byte timestamp or extended timestamp fields)
         };
 
+        // state of the chunk streams of one direction, ids 2-63 are stored in place
+        class ChunkStreams
+        {
+        public:
+            // message that is assembled from the chunks of a chunk stream
+            struct Message
+            {
+                Header header; // header of the first chunk
+                std::vector<uint8_t> data;
+                uint32_t remainingBytes = 0;
+            };
+
+            const Header& get(uint32_t channel) const;
+            void set(uint32_t channel, const Header& header);
+            Message& getMessage(uint32_t channel);
+            void clear();
+
+        private:
+            static const uint32_t DENSE_CHANNELS = 64;
+
+            struct Entry
+            {
+                Header header; // last header
+                Message message;
+            };
+
+            Entry& getEntry(uint32_t channel);
+
+            Entry dense[DENSE_CHANNELS];
+            std::map<uint32_t, Entry> overflow;
+        };
+
         struct Packet
         {
             uint32_t channel = Channel::NONE;
@@ -85,8 +118,11 @@ namespace relay
 
             std::vector<uint8_t> data;
 
-            uint32_t decode(const std::vector<uint8_t>& data, uint32_t offset, uint32_t chunkSize, std::map<uint32_t, rtmp::Header>& previousPackets);
-            uint32_t encode(std::vector<uint8_t>& data, uint32_t chunkSize, std::map<uint32_t, rtmp::Header>& previousPackets) const;
+            // consumes whole chunks until one of them completes a message, chunks of other messages are kept in the chunk streams
+            uint32_t decode(const uint8_t* buffer, uint32_t bufferSize, uint32_t offset, uint32_t chunkSize, ChunkStreams& previousPackets, bool& complete);
+            uint32_t encode(std::vector<uint8_t>& data, uint32_t chunkSize, ChunkStreams& previousPackets) const;
+            // encodes the header of the first chunk and the header of the following chunks of a payload of the given length that is sent separately
+            bool encodeHeaders(std::vector<uint8_t>& firstHeader, std::vector<uint8_t>& nextHeader, uint32_t length, ChunkStreams& previousPackets) const;
         };
 
         struct Challenge
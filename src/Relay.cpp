@@ -3,13 +3,12 @@
 //
 
 #include <ctime>
+#include <map>
 #include <memory>
 #include <algorithm>
 #include <functional>
 #include <iostream>
 #include <chrono>
-#include <regex>
-#include <thread>
 #include <sstream>
 #include <iostream>
 #include <iomanip>
@@ -17,21 +16,26 @@
 #include "Log.hpp"
 #include "Relay.hpp"
 #include "Status.hpp"
+#include "Trace.hpp"
 #include "Connection.hpp"
+#include "Worker.hpp"
 
 namespace relay
 {
-    uint64_t Relay::currentId = 0;
+    std::atomic<uint64_t> Relay::currentId(0);
 
     Relay::Relay(Network& aNetwork):
         generator(static_cast<unsigned int>(std::chrono::high_resolution_clock::now().time_since_epoch().count())),
-        network(aNetwork)
+        network(aNetwork),
+        cleanupTimer(aNetwork),
+        timeoutTimer(aNetwork)
     {
-        previousTime = std::chrono::steady_clock::now();
     }
 
     Relay::~Relay()
     {
+        workers.clear();
+
         for (auto& a : servers)
         {
             a->stop();
@@ -45,7 +49,11 @@ namespace relay
 
     bool Relay::init(const std::string& config)
     {
+        workers.clear();
+        shards.clear();
         servers.clear();
+        endpointIndex.clear();
+        endpointCache.clear();
         connections.clear();
         status.reset();
 
@@ -66,6 +74,9 @@ namespace relay
             return false;
         }
 
+        // the log thread is restarted with the new settings
+        Log::stopAsync();
+
         if (document["log"])
         {
             const YAML::Node& logObject = document["log"];
@@ -75,6 +86,24 @@ namespace relay
                 Log::threshold = static_cast<Log::Level>(logObject["level"].as<uint32_t>());
             }
 
+            if (logObject["file"])
+            {
+                if (!Log::setFile(logObject["file"].as<std::string>()))
+                {
+                    return false;
+                }
+            }
+
+            if (logObject["async"])
+            {
+                logAsync = logObject["async"].as<bool>();
+            }
+
+            if (logObject["asyncQueueSize"])
+            {
+                logAsyncQueueSize = logObject["asyncQueueSize"].as<uint32_t>();
+            }
+
 #ifndef _WIN32
             if (logObject["syslogEnabled"])
             {
@@ -105,13 +134,62 @@ namespace relay
 
         openLog();
 
+        if (logAsync && !Log::startAsync(logAsyncQueueSize))
+        {
+            return false;
+        }
+
+        Trace::close();
+
+        if (document["trace"])
+        {
+            const YAML::Node& traceObject = document["trace"];
+
+            if (!traceObject["file"])
+            {
+                Log(Log::Level::ERR) << "Trace configuration is missing file";
+                return false;
+            }
+
+            uint64_t traceSize = traceObject["size"] ? traceObject["size"].as<uint64_t>() : 1024 * 1024;
+
+            if (!Trace::open(traceObject["file"].as<std::string>(), traceSize))
+            {
+                return false;
+            }
+
+            Trace::setEnabled(traceObject["enabled"] ? traceObject["enabled"].as<bool>() : true);
+        }
+
         if (document["timeout"])
         {
             float ts = document["timeout"].as<float>();
-            timeout = std::chrono::steady_clock::now() + std::chrono::milliseconds(static_cast<int>(ts * 1000));
-            hasTimeout = true;
+            timeoutTimer.start(ts, std::bind(&Relay::handleTimeout, this, std::placeholders::_1));
         }
 
+#ifdef __linux__
+        Network::Backend ioBackend = Network::Backend::EPOLL;
+#else
+        Network::Backend ioBackend = Network::Backend::POLL;
+#endif
+
+        if (document["ioBackend"])
+        {
+            std::string backendName = document["ioBackend"].as<std::string>();
+
+            if (backendName == "poll") ioBackend = Network::Backend::POLL;
+            else if (backendName == "epoll") ioBackend = Network::Backend::EPOLL;
+            else if (backendName == "io_uring") ioBackend = Network::Backend::IO_URING;
+            else
+            {
+                Log(Log::Level::ERR) << "Invalid I/O backend " << backendName;
+                return false;
+            }
+        }
+
+        // the fallback is reported by setBackend
+        network.setBackend(ioBackend);
+
         if (document["statusPage"])
         {
             const YAML::Node& statusPageObject = document["statusPage"];
@@ -122,7 +200,64 @@ namespace relay
             }
         }
 
-        std::set<std::string> listenAddresses;
+        uint32_t workerCount = 1;
+
+        if (document["workers"])
+        {
+            workerCount = document["workers"].as<uint32_t>();
+        }
+
+#ifdef _WIN32
+        if (workerCount > 1)
+        {
+            Log(Log::Level::WARN) << "Workers are not supported on Windows";
+            workerCount = 1;
+        }
+#endif
+
+        if (workerCount > 1)
+        {
+            shards.push_back(this);
+
+            for (uint32_t i = 1; i < workerCount; ++i)
+            {
+                std::unique_ptr<Worker> worker(new Worker(i));
+                worker->getRelay().getNetwork().setBackend(ioBackend);
+                shards.push_back(&worker->getRelay());
+                workers.push_back(std::move(worker));
+            }
+
+            for (Relay* shard : shards)
+            {
+                shard->shards = shards;
+                shard->network.setWakeupCallback(std::bind(&Relay::handleTasks, shard));
+            }
+
+            Worker::setAffinity(0);
+        }
+
+        if (!initServers(document, workerCount > 1))
+        {
+            return false;
+        }
+
+        for (const auto& worker : workers)
+        {
+            if (!worker->getRelay().initServers(document, true))
+            {
+                return false;
+            }
+
+            worker->start();
+        }
+
+        return true;
+    }
+
+    bool Relay::initServers(const YAML::Node& document, bool reusePort)
+    {
+        // the listening sockets get the largest buffers and backlog of the host endpoints on their address
+        std::map<std::string, Socket::Options> listenAddresses;
 
         const YAML::Node& serversArray = document["servers"];
 
@@ -141,6 +276,7 @@ namespace relay
                     const YAML::Node& endpointObject = endpointsArray[endpointIndex];
 
                     Endpoint endpoint;
+                    std::vector<std::string> endpointListenAddresses;
 
                     if (!endpointObject["type"] || !endpointObject["direction"] || !endpointObject["address"])
                     {
@@ -174,7 +310,7 @@ namespace relay
 
                             if (endpoint.connectionType == Connection::Type::HOST)
                             {
-                                listenAddresses.insert(address);
+                                endpointListenAddresses.push_back(address);
                             }
                         }
                     }
@@ -198,10 +334,47 @@ namespace relay
                     if (endpointObject["reconnectCount"]) endpoint.reconnectCount = endpointObject["reconnectCount"].as<uint32_t>();
                     if (endpointObject["pingInterval"]) endpoint.pingInterval = endpointObject["pingInterval"].as<float>();
                     if (endpointObject["bufferSize"]) endpoint.bufferSize = endpointObject["bufferSize"].as<uint32_t>();
+                    if (endpointObject["sendQueueSize"]) endpoint.sendQueueSize = endpointObject["sendQueueSize"].as<uint32_t>();
+                    if (endpointObject["sendQueueDuration"]) endpoint.sendQueueDuration = endpointObject["sendQueueDuration"].as<uint32_t>();
+                    if (endpointObject["gopCacheSize"]) endpoint.gopCacheSize = endpointObject["gopCacheSize"].as<uint32_t>();
+                    if (endpointObject["lowLatencyJoin"]) endpoint.lowLatencyJoin = endpointObject["lowLatencyJoin"].as<bool>();
+                    if (endpointObject["joinLatency"]) endpoint.joinLatency = endpointObject["joinLatency"].as<uint32_t>();
+                    if (endpointObject["zeroCopyThreshold"]) endpoint.zeroCopyThreshold = endpointObject["zeroCopyThreshold"].as<uint32_t>();
+                    if (endpointObject["noDelay"]) endpoint.socketOptions.noDelay = endpointObject["noDelay"].as<bool>();
+                    if (endpointObject["sendBufferSize"]) endpoint.socketOptions.sendBufferSize = endpointObject["sendBufferSize"].as<uint32_t>();
+                    if (endpointObject["receiveBufferSize"]) endpoint.socketOptions.receiveBufferSize = endpointObject["receiveBufferSize"].as<uint32_t>();
+                    if (endpointObject["listenBacklog"]) endpoint.socketOptions.listenBacklog = endpointObject["listenBacklog"].as<uint32_t>();
+                    if (endpointObject["keepAlive"]) endpoint.socketOptions.keepAlive = endpointObject["keepAlive"].as<bool>();
+                    if (endpointObject["keepAliveIdle"]) endpoint.socketOptions.keepAliveIdle = endpointObject["keepAliveIdle"].as<uint32_t>();
+                    if (endpointObject["keepAliveInterval"]) endpoint.socketOptions.keepAliveInterval = endpointObject["keepAliveInterval"].as<uint32_t>();
+                    if (endpointObject["keepAliveCount"]) endpoint.socketOptions.keepAliveCount = endpointObject["keepAliveCount"].as<uint32_t>();
+                    if (endpointObject["notSentLowWatermark"]) endpoint.socketOptions.notSentLowWatermark = endpointObject["notSentLowWatermark"].as<uint32_t>();
+                    if (endpointObject["userTimeout"]) endpoint.socketOptions.userTimeout = endpointObject["userTimeout"].as<uint32_t>();
+
+                    for (const std::string& address : endpointListenAddresses)
+                    {
+                        auto result = listenAddresses.insert(std::make_pair(address, endpoint.socketOptions));
+                        Socket::Options& listenOptions = result.first->second;
+
+                        if (!result.second)
+                        {
+                            listenOptions.sendBufferSize = std::max(listenOptions.sendBufferSize, endpoint.socketOptions.sendBufferSize);
+                            listenOptions.receiveBufferSize = std::max(listenOptions.receiveBufferSize, endpoint.socketOptions.receiveBufferSize);
+                            listenOptions.listenBacklog = std::max(listenOptions.listenBacklog, endpoint.socketOptions.listenBacklog);
+                        }
+                    }
 
                     if (endpointObject["applicationName"]) endpoint.applicationName = endpointObject["applicationName"].as<std::string>();
                     if (endpointObject["streamName"]) endpoint.streamName = endpointObject["streamName"].as<std::string>();
 
+                    if (endpoint.connectionType == Connection::Type::HOST &&
+                        (!endpoint.applicationNameMatcher.compile(endpoint.applicationName) ||
+                         !endpoint.streamNameMatcher.compile(endpoint.streamName)))
+                    {
+                        Log(Log::Level::ERR) << "Configuration error: Invalid regex for endpoint application \"" << endpoint.applicationName << "\", stream \"" << endpoint.streamName << "\"";
+                        return false;
+                    }
+
                     if (endpointObject["metaDataBlacklist"])
                     {
                         const YAML::Node& metaDataBlacklistArray = endpointObject["metaDataBlacklist"];
@@ -255,9 +428,21 @@ namespace relay
             servers.push_back(std::move(server));
         }
 
-        for (const std::string& address : listenAddresses)
+        indexEndpoints();
+
+        for (const auto& listenAddress : listenAddresses)
         {
+            const std::string& address = listenAddress.first;
+
+            // the accepted sockets get the rest of the options when the endpoint is known
+            Socket::Options options;
+            options.sendBufferSize = listenAddress.second.sendBufferSize;
+            options.receiveBufferSize = listenAddress.second.receiveBufferSize;
+            options.listenBacklog = listenAddress.second.listenBacklog;
+
             Socket acceptor(network);
+            acceptor.setReusePort(reusePort);
+            acceptor.setOptions(options);
             acceptor.setAcceptCallback(std::bind(&Relay::handleAccept, this, std::placeholders::_1, std::placeholders::_2));
             acceptor.startAccept(address);
             acceptors.push_back(std::move(acceptor));
@@ -266,66 +451,99 @@ namespace relay
         return true;
     }
 
+    void Relay::indexEndpoints()
+    {
+        endpointIndex.clear();
+        endpointCache.clear();
+
+        for (const std::unique_ptr<Server>& server : servers)
+        {
+            for (const Endpoint& endpoint : server->getEndpoints())
+            {
+                if (endpoint.connectionType != Connection::Type::HOST) continue;
+
+                std::set<uint16_t> ports;
+                for (const Endpoint::Address& endpointAddress : endpoint.addresses)
+                {
+                    ports.insert(endpointAddress.ipAddresses.second);
+                }
+
+                for (uint16_t port : ports)
+                {
+                    endpointIndex[std::make_pair(port, endpoint.direction)].push_back(std::make_pair(server.get(), &endpoint));
+                }
+            }
+        }
+    }
+
     std::vector<std::pair<Server*, const Endpoint*>> Relay::getEndpoints(const std::pair<uint32_t, uint16_t>& address,
                                                                          Connection::Direction direction,
                                                                          const std::string& applicationName,
                                                                          const std::string& streamName) const
     {
+        std::string key;
+        key.reserve(sizeof(address) + sizeof(direction) + applicationName.size() + streamName.size() + 1);
+        key.append(reinterpret_cast<const char*>(&address.first), sizeof(address.first));
+        key.append(reinterpret_cast<const char*>(&address.second), sizeof(address.second));
+        key.append(reinterpret_cast<const char*>(&direction), sizeof(direction));
+        key.append(applicationName);
+        key.push_back('\0');
+        key.append(streamName);
+
+        auto cacheIterator = endpointCache.find(key);
+        if (cacheIterator != endpointCache.end()) return cacheIterator->second;
+
         std::vector<std::pair<Server*, const Endpoint*>> result;
 
-        for (const std::unique_ptr<Server>& server : servers)
+        auto indexIterator = endpointIndex.find(std::make_pair(address.second, direction));
+
+        if (indexIterator != endpointIndex.end())
         {
-            for (const Endpoint& endpoint : server->getEndpoints())
+            for (const std::pair<Server*, const Endpoint*>& entry : indexIterator->second)
             {
-                try
+                const Endpoint& endpoint = *entry.second;
+
+                if (endpoint.applicationNameMatcher.match(applicationName) &&
+                    endpoint.streamNameMatcher.match(streamName))
                 {
-                    if (endpoint.connectionType == Connection::Type::HOST &&
-                        (endpoint.applicationName.empty() || std::regex_match(applicationName, std::regex(endpoint.applicationName))) &&
-                        (endpoint.streamName.empty() || std::regex_match(streamName, std::regex(endpoint.streamName))))
-                    {
-                        Log(Log::Level::ALL) << "Application \"" << applicationName << "\", stream \"" << streamName << "\" matched endpoint application \"" << endpoint.applicationName << "\", stream \"" << endpoint.streamName << "\"";
+                    RELAY_LOG(Log::Level::ALL) << "Application \"" << applicationName << "\", stream \"" << streamName << "\" matched endpoint application \"" << endpoint.applicationName << "\", stream \"" << endpoint.streamName << "\"";
 
-                        if (endpoint.direction == direction)
-                        {
-                            bool found = false;
+                    bool found = false;
 
-                            for (auto endpointAddress : endpoint.addresses)
-                            {
-                                if ((endpointAddress.ipAddresses.first == ANY_ADDRESS ||
-                                     address.first == ANY_ADDRESS ||
-                                     endpointAddress.ipAddresses.first == address.first) &&
-                                    endpointAddress.ipAddresses.second == address.second)
-                                {
-                                    Log(Log::Level::ALL) << "Address " << ipToString(address.first) << ":" << address.second << " matched address " << ipToString(endpointAddress.ipAddresses.first) << ":" << endpointAddress.ipAddresses.second;
-
-                                    found = true;
-                                    break;
-                                }
-                                else
-                                {
-                                    Log(Log::Level::ALL) << "Address " << ipToString(address.first) << ":" << address.second << " did not match address " << ipToString(endpointAddress.ipAddresses.first) << ":" << endpointAddress.ipAddresses.second;
-                                }
-                            }
+                    for (auto endpointAddress : endpoint.addresses)
+                    {
+                        if ((endpointAddress.ipAddresses.first == ANY_ADDRESS ||
+                             address.first == ANY_ADDRESS ||
+                             endpointAddress.ipAddresses.first == address.first) &&
+                            endpointAddress.ipAddresses.second == address.second)
+                        {
+                            RELAY_LOG(Log::Level::ALL) << "Address " << ipToString(address.first) << ":" << address.second << " matched address " << ipToString(endpointAddress.ipAddresses.first) << ":" << endpointAddress.ipAddresses.second;
 
-                            if (found)
-                            {
-                                result.push_back(std::make_pair(server.get(), &endpoint));
-                            }
+                            found = true;
+                            break;
+                        }
+                        else
+                        {
+                            RELAY_LOG(Log::Level::ALL) << "Address " << ipToString(address.first) << ":" << address.second << " did not match address " << ipToString(endpointAddress.ipAddresses.first) << ":" << endpointAddress.ipAddresses.second;
                         }
                     }
-                    else
+
+                    if (found)
                     {
-                        Log(Log::Level::ALL) << "Application: \"" << applicationName << "\", stream: \"" << streamName << "\" did not match endpoint application: \"" << endpoint.applicationName << "\", stream: \"" << endpoint.streamName << "\"";
+                        result.push_back(entry);
                     }
                 }
-                catch (std::regex_error e)
+                else
                 {
-                    Log(Log::Level::ERR) << "Configuration error: Invalid regex for output connection";
-                    exit(1);
+                    RELAY_LOG(Log::Level::ALL) << "Application: \"" << applicationName << "\", stream: \"" << streamName << "\" did not match endpoint application: \"" << endpoint.applicationName << "\", stream: \"" << endpoint.streamName << "\"";
                 }
             }
         }
 
+        // names come from the clients, so the cache is bounded
+        if (endpointCache.size() >= ENDPOINT_CACHE_SIZE) endpointCache.clear();
+        endpointCache[key] = result;
+
         return result;
     }
 
@@ -338,50 +556,215 @@ namespace relay
 
     void Relay::run()
     {
-        const std::chrono::microseconds sleepTime(5000);
-
         while (active)
         {
-            auto currentTime = std::chrono::steady_clock::now();
-            if (hasTimeout && currentTime > timeout)
+            network.update();
+        }
+
+        workers.clear();
+    }
+
+    void Relay::post(const std::function<void()>& task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(taskMutex);
+            tasks.push_back(task);
+        }
+
+        network.wakeup();
+    }
+
+    void Relay::handleTasks()
+    {
+        std::vector<std::function<void()>> currentTasks;
+
+        {
+            std::lock_guard<std::mutex> lock(taskMutex);
+            currentTasks.swap(tasks);
+        }
+
+        for (const auto& task : currentTasks)
+        {
+            task();
+        }
+    }
+
+    Relay& Relay::getShard(const std::string& applicationName, const std::string& streamName)
+    {
+        if (shards.size() <= 1) return *this;
+
+        size_t hash = std::hash<std::string>()(applicationName + "/" + streamName);
+
+        return *shards[hash % shards.size()];
+    }
+
+    void Relay::adoptConnection(const std::shared_ptr<Connection::Handover>& handover)
+    {
+        std::unique_ptr<Connection> connection(new Connection(*this, *handover));
+
+        connections.push_back(std::move(connection));
+    }
+
+    void Relay::cleanup()
+    {
+        // delete the closed objects after the current callback returns
+        if (!cleanupTimer.isActive())
+        {
+            cleanupTimer.start(0.0f, std::bind(&Relay::handleCleanup, this, std::placeholders::_1));
+        }
+    }
+
+    void Relay::handleCleanup(Timer&)
+    {
+        if (status) status->update();
+
+        for (auto i = connections.begin(); i != connections.end();)
+        {
+            i = ((*i)->isClosed() ? connections.erase(i) : i + 1);
+        }
+
+        for (const auto& server : servers)
+        {
+            server->update();
+        }
+    }
+
+    void Relay::handleTimeout(Timer&)
+    {
+        active = false;
+    }
+
+    void Relay::getStats(std::string& str, ReportType reportType) const
+    {
+        if (workers.empty())
+        {
+            getLocalStats(str, reportType);
+            return;
+        }
+
+        // the workers report their own objects, on their own threads
+        std::vector<std::future<std::string>> results;
+
+        for (const auto& worker : workers)
+        {
+            std::shared_ptr<std::promise<std::string>> result = std::make_shared<std::promise<std::string>>();
+            results.push_back(result->get_future());
+
+            Relay& workerRelay = worker->getRelay();
+            workerRelay.post(std::bind(&Relay::collectStats, &workerRelay, result, reportType));
+        }
+
+        std::vector<std::string> stats(1);
+        getLocalStats(stats[0], reportType);
+
+        // one deadline for all workers, so that a busy worker does not extend the wait for the others
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+
+        for (auto& result : results)
+        {
+            if (result.wait_until(deadline) == std::future_status::ready)
             {
-                break;
+                stats.push_back(result.get());
             }
+            else
+            {
+                stats.push_back(std::string());
+            }
+        }
 
-            float delta = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - previousTime).count() / 1000.0f;
-            previousTime = currentTime;
+        formatStats(stats, reportType, str);
+    }
 
-            network.update();
+    std::shared_ptr<StatsReport> Relay::requestStats(ReportType reportType)
+    {
+        std::shared_ptr<StatsReport> report = std::make_shared<StatsReport>();
+        report->reportType = reportType;
+        report->stats.resize(workers.size() + 1);
+        report->pending = workers.size();
+
+        for (size_t i = 0; i < workers.size(); ++i)
+        {
+            Relay& workerRelay = workers[i]->getRelay();
+            workerRelay.post(std::bind(&Relay::reportStats, &workerRelay, this, report, i + 1));
+        }
+
+        getLocalStats(report->stats[0], reportType);
+
+        return report;
+    }
 
-            if (status) status->update(delta);
+    void Relay::formatStats(const std::vector<std::string>& stats, ReportType reportType, std::string& str)
+    {
+        if (stats.size() == 1)
+        {
+            str = stats[0];
+            return;
+        }
 
-            for (auto i = connections.begin(); i != connections.end();)
+        switch (reportType)
+        {
+            case ReportType::TEXT:
             {
-                const std::unique_ptr<Connection>& connection = *i;
+                str.clear();
 
-                if (connection->isClosed())
+                for (size_t i = 0; i < stats.size(); ++i)
                 {
-                    i = connections.erase(i);
-                    continue;
+                    str += "Worker " + std::to_string(i) + ":\n" + stats[i] + "\n";
                 }
-                else
+                break;
+            }
+            case ReportType::HTML:
+            {
+                str.clear();
+
+                for (size_t i = 0; i < stats.size(); ++i)
                 {
-                    ++i;
+                    str += "<b>Worker " + std::to_string(i) + "</b><br>" + stats[i];
                 }
-
-                connection->update(delta);
+                break;
             }
-
-            for (const auto& server : servers)
+            case ReportType::JSON:
             {
-                server->update(delta);
+                str = "{\"workers\":[";
+
+                for (size_t i = 0; i < stats.size(); ++i)
+                {
+                    if (i > 0) str += ",";
+                    str += stats[i].empty() ? "null" : stats[i];
+                }
+
+                str += "]}";
+                break;
             }
+        }
+    }
+
+    void Relay::collectStats(const std::shared_ptr<std::promise<std::string>>& result, ReportType reportType) const
+    {
+        std::string str;
+        getLocalStats(str, reportType);
+        result->set_value(str);
+    }
 
-            std::this_thread::sleep_for(sleepTime);
+    void Relay::reportStats(Relay* target, const std::shared_ptr<StatsReport>& report, size_t index) const
+    {
+        // the report is only modified on the thread of the target
+        std::string str;
+        getLocalStats(str, report->reportType);
+        target->post(std::bind(&Relay::addStats, target, report, index, str));
+    }
+
+    void Relay::addStats(const std::shared_ptr<StatsReport>& report, size_t index, const std::string& str)
+    {
+        report->stats[index] = str;
+
+        if (--report->pending == 0 && report->completeCallback)
+        {
+            report->completeCallback();
         }
     }
 
-    void Relay::getStats(std::string& str, ReportType reportType) const
+    void Relay::getLocalStats(std::string& str, ReportType reportType) const
     {
         std::map<Connection*, Stream*> cons;
         std::map<Stream*, Connection*> streams;
@@ -413,6 +796,8 @@ namespace relay
                 << std::setw(7) << "Type" << " "
                 << std::setw(20) << "State" << " "
                 << std::setw(10) << "Direction" << " "
+                << std::setw(8) << "Dropped" << " "
+                << std::setw(20) << "Latency p50/p99/p999" << " "
 
                 << std::setw(6) << "Server" << " " << " Metadata\n";
 
@@ -457,7 +842,7 @@ namespace relay
             }
             case ReportType::HTML:
             {
-                auto header = "<table border=\"1\" cellspacing=\"0\" cellpadding=\"5\"><tr><th>ID</th><th>Name</th><th>Application</th><th>Status</th><th>Address</th><th>Connection</th><th>State</th><th>Direction</th><th>Server ID</th><th>Meta data</th></tr>";
+                auto header = "<table border=\"1\" cellspacing=\"0\" cellpadding=\"5\"><tr><th>ID</th><th>Name</th><th>Application</th><th>Status</th><th>Address</th><th>Connection</th><th>State</th><th>Direction</th><th>Dropped frames</th><th>Latency p50/p99/p999 (ms)</th><th>Server ID</th><th>Meta data</th></tr>";
 
                 str = "<html><title>Status</title><body>";
 
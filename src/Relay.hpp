@@ -4,24 +4,38 @@
 
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <future>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <random>
+#include <unordered_map>
 #include <vector>
 #include <utility>
 #include <chrono>
 #include "Network.hpp"
 #include "Socket.hpp"
+#include "Timer.hpp"
 #include "Status.hpp"
 #include "Server.hpp"
 #include "Endpoint.hpp"
+#include "StreamRegistry.hpp"
 
 #ifndef _WIN32
 #  include <sys/syslog.h>
 #endif
 
+namespace YAML
+{
+    class Node;
+}
+
 namespace relay
 {
     class Status;
+    class Worker;
 
     class Relay
     {
@@ -43,8 +57,25 @@ namespace relay
         void close();
 
         void run();
+        void cleanup();
+
+        // runs the task on the thread of the relay, can be called from any thread
+        void post(const std::function<void()>& task);
 
+        // the relay of the worker that owns the stream
+        Relay& getShard(const std::string& applicationName, const std::string& streamName);
+        void adoptConnection(const std::shared_ptr<Connection::Handover>& handover);
+
+        // blocks until the workers have reported, for the callers that do not return to the loop
         void getStats(std::string& str, ReportType reportType) const;
+        // asks the workers for their reports without blocking, the complete callback of the report is called
+        // on the thread of this relay once all of them have answered
+        std::shared_ptr<StatsReport> requestStats(ReportType reportType);
+        static void formatStats(const std::vector<std::string>& stats, ReportType reportType, std::string& str);
+
+        // open streams of all servers of this relay
+        StreamRegistry& getStreamRegistry() { return streamRegistry; }
+        const StreamRegistry& getStreamRegistry() const { return streamRegistry; }
 
         void openLog();
         void closeLog();
@@ -55,23 +86,52 @@ namespace relay
                                                                       const std::string& streamName) const;
 
     private:
+        bool initServers(const YAML::Node& document, bool reusePort);
+        void indexEndpoints();
+
+        void getLocalStats(std::string& str, ReportType reportType) const;
+        void collectStats(const std::shared_ptr<std::promise<std::string>>& result, ReportType reportType) const;
+        void reportStats(Relay* target, const std::shared_ptr<StatsReport>& report, size_t index) const;
+        void addStats(const std::shared_ptr<StatsReport>& report, size_t index, const std::string& str);
+
+        void handleTasks();
         void handleAccept(Socket& acceptor, Socket& clientSocket);
+        void handleCleanup(Timer& timer);
+        void handleTimeout(Timer& timer);
 
-        static uint64_t currentId;
+        static std::atomic<uint64_t> currentId;
         std::mt19937 generator;
         bool active = true;
 
         Network& network;
         std::unique_ptr<Status> status;
-        std::chrono::steady_clock::time_point previousTime;
-        std::chrono::steady_clock::time_point timeout;
-        bool hasTimeout = false;
+        Timer cleanupTimer;
+        Timer timeoutTimer;
 
+        // declared before the servers, so that it outlives their streams
+        StreamRegistry streamRegistry;
         std::vector<std::unique_ptr<Server>> servers;
         std::vector<std::unique_ptr<Connection>> connections;
 
         std::vector<Socket> acceptors;
 
+        // host endpoints by listen port and direction
+        std::map<std::pair<uint16_t, Connection::Direction>, std::vector<std::pair<Server*, const Endpoint*>>> endpointIndex;
+
+        // recent results of getEndpoints by address, direction, application and stream name
+        static const size_t ENDPOINT_CACHE_SIZE = 1024;
+        mutable std::unordered_map<std::string, std::vector<std::pair<Server*, const Endpoint*>>> endpointCache;
+
+        // relays of all workers, including this one
+        std::vector<Relay*> shards;
+        std::vector<std::unique_ptr<Worker>> workers;
+
+        std::mutex taskMutex;
+        std::vector<std::function<void()>> tasks;
+
+        bool logAsync = false;
+        uint32_t logAsyncQueueSize = 8192; // lines
+
 #ifndef _WIN32
         std::string syslogIdent;
         int syslogFacility = LOG_USER;
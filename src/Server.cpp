@@ -15,6 +15,14 @@ namespace relay
     {
     }
 
+    Server::~Server()
+    {
+        for (auto& s : streams)
+        {
+            relay.getStreamRegistry().erase(*s);
+        }
+    }
+
     void Server::stop()
     {
         for (auto& s : streams)
@@ -31,17 +39,7 @@ namespace relay
     Stream* Server::findStream(const std::string& applicationName,
                                const std::string& streamName) const
     {
-        for (auto i = streams.begin(); i != streams.end(); ++i)
-        {
-            if ((*i)->getApplicationName() == applicationName &&
-                (*i)->getStreamName() == streamName &&
-                !(*i)->isClosed())
-            {
-                return i->get();
-            }
-        }
-
-        return nullptr;
+        return relay.getStreamRegistry().find(*this, applicationName, streamName);
     }
 
     Connection* Server::createConnection(Stream& stream,
@@ -49,23 +47,26 @@ namespace relay
     {
         std::unique_ptr<Connection> connection(new Connection(relay, stream, endpoint));
         Connection* connectionPtr = connection.get();
-        connections.push_back(std::move(connection));
+        addConnection(std::move(connection));
 
         return connectionPtr;
     }
 
+    void Server::addConnection(std::unique_ptr<Connection> connection)
+    {
+        const Connection* connectionPtr = connection.get();
+        connections.push_back(std::move(connection));
+        connectionPositions[connectionPtr] = std::prev(connections.end());
+    }
+
     void Server::deleteConnection(Connection* connection)
     {
-        for (auto i = connections.begin(); i != connections.end();)
+        auto i = connectionPositions.find(connection);
+
+        if (i != connectionPositions.end())
         {
-            if (i->get() == connection)
-            {
-                i = connections.erase(i);
-            }
-            else
-            {
-                ++i;
-            }
+            connections.erase(i->second);
+            connectionPositions.erase(i);
         }
     }
 
@@ -75,22 +76,21 @@ namespace relay
         std::unique_ptr<Stream> stream(new Stream(*this, applicationName, streamName));
         Stream* streamPtr = stream.get();
         streams.push_back(std::move(stream));
+        streamPositions[streamPtr] = std::prev(streams.end());
+        relay.getStreamRegistry().insert(*streamPtr);
 
         return streamPtr;
     }
 
     void Server::deleteStream(Stream* stream)
     {
-        for (auto i = streams.begin(); i != streams.end();)
+        auto i = streamPositions.find(stream);
+
+        if (i != streamPositions.end())
         {
-            if (i->get() == stream)
-            {
-                i = streams.erase(i);
-            }
-            else
-            {
-                ++i;
-            }
+            relay.getStreamRegistry().erase(*stream);
+            streams.erase(i->second);
+            streamPositions.erase(i);
         }
     }
 
@@ -104,6 +104,9 @@ namespace relay
                 endpoint.direction == Connection::Direction::INPUT &&
                 endpoint.isNameKnown())
             {
+                // pulled by the worker that owns the stream
+                if (&relay.getShard(endpoint.applicationName, endpoint.streamName) != &relay) continue;
+
                 Socket socket(network);
 
                 Stream* stream = createStream(endpoint.applicationName,
@@ -117,42 +120,46 @@ namespace relay
 
                 connection->connect();
 
-                connections.push_back(std::move(connection));
+                addConnection(std::move(connection));
             }
         }
     }
 
-    void Server::update(float delta)
+    void Server::update()
     {
         for (auto i = connections.begin(); i != connections.end();)
         {
-            i = ((*i)->isClosed() ? connections.erase(i) : i + 1);
+            if ((*i)->isClosed())
+            {
+                connectionPositions.erase(i->get());
+                i = connections.erase(i);
+            }
+            else
+            {
+                ++i;
+            }
         }
 
         for (auto si = streams.begin(); si != streams.end();)
         {
-            si = ((*si)->isClosed() ? streams.erase(si) : si + 1);
-        }
-
-        // update connections
-        for (auto i = connections.begin(); i != connections.end();)
-        {
-            const std::unique_ptr<Connection>& connection = *i;
-
-            if (connection->isClosed())
+            if ((*si)->isClosed())
             {
-                i = connections.erase(i);
-                continue;
+                relay.getStreamRegistry().erase(**si);
+                streamPositions.erase(si->get());
+                si = streams.erase(si);
             }
             else
             {
-                ++i;
+                ++si;
             }
-
-            connection->update(delta);
         }
     }
 
+    void Server::cleanup()
+    {
+        relay.cleanup();
+    }
+
     void Server::getConnections(std::map<Connection*, Stream*>& cons)
     {
         for (auto& c : connections)
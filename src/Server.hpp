@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <list>
+#include <unordered_map>
 #include <vector>
 #include "Connection.hpp"
 #include "Endpoint.hpp"
@@ -15,6 +17,7 @@ namespace relay
     {
     public:
         Server(Relay& aRelay, Network& aNetwork);
+        ~Server();
 
         Server(const Server&) = delete;
         Server(Server&&) = delete;
@@ -34,11 +37,11 @@ namespace relay
 
         void start(const std::vector<Endpoint>& aEndpoints);
 
-        void update(float delta);
+        void update();
         void getStats(std::string& str, ReportType reportType) const;
 
         const std::vector<Endpoint>& getEndpoints() const { return endpoints; }
-        void cleanup() { needsCleanup = true; }
+        void cleanup();
         void getConnections(std::map<Connection*, Stream*>& cons);
 
         void stop();
@@ -50,11 +53,13 @@ namespace relay
         Network& network;
         std::vector<Endpoint> endpoints;
 
-        std::vector<std::unique_ptr<Stream>> streams;
-        std::vector<std::unique_ptr<Connection>> connections;
-
-        bool needsCleanup = false;
+        // lists keep the order of creation, the positions make removal O(1)
+        std::list<std::unique_ptr<Stream>> streams;
+        std::unordered_map<const Stream*, std::list<std::unique_ptr<Stream>>::iterator> streamPositions;
+        std::list<std::unique_ptr<Connection>> connections;
+        std::unordered_map<const Connection*, std::list<std::unique_ptr<Connection>>::iterator> connectionPositions;
 
+        void addConnection(std::unique_ptr<Connection> connection);
         void deleteConnection(Connection* connection);
     };
 }
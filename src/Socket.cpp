@@ -11,19 +11,40 @@
 #  undef WIN32_LEAN_AND_MEAN
 #else
 #  include <sys/socket.h>
+#  include <sys/uio.h>
+#  include <limits.h>
 #  include <netdb.h>
+#  include <netinet/in.h>
+#  include <netinet/tcp.h>
 #  include <unistd.h>
 #endif
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#  include <linux/errqueue.h>
+#  define HAVE_ZERO_COPY 1
+#endif
+#include <algorithm>
 #include <cstring>
 #include <fcntl.h>
 #include "Socket.hpp"
 #include "Network.hpp"
 #include "Log.hpp"
+#include "Trace.hpp"
 
 namespace relay
 {
-    static const int WAITING_QUEUE_SIZE = 5;
-    static uint8_t TEMP_BUFFER[65536];
+    // segments that are sent with one call
+#if defined(IOV_MAX) && IOV_MAX < 1024
+    static const size_t MAX_WRITE_SEGMENTS = IOV_MAX;
+#else
+    static const size_t MAX_WRITE_SEGMENTS = 1024;
+#endif
+    // bytes that are received with one call and in one loop iteration, so that a fast sender does not starve the others
+    static const size_t READ_SIZE = 65536;
+    static const size_t READ_BUDGET = 262144;
+#ifdef HAVE_ZERO_COPY
+    // milliseconds that a closed socket can wait for the peer to acknowledge its zero copy data
+    static const uint32_t ZERO_COPY_LINGER_TIMEOUT = 60000;
+#endif
 
 #ifdef _WIN32
     static inline bool initWSA()
@@ -48,6 +69,20 @@ namespace relay
     }
 #endif
 
+    static bool setNonBlocking(socket_t socketFd)
+    {
+#ifdef _WIN32
+        unsigned long mode = 1;
+        return ioctlsocket(socketFd, FIONBIO, &mode) == 0;
+#else
+        int flags = fcntl(socketFd, F_GETFL, 0);
+        if (flags < 0) return false;
+        flags |= O_NONBLOCK;
+
+        return fcntl(socketFd, F_SETFL, flags) == 0;
+#endif
+    }
+
     bool Socket::getAddress(const std::string& address, std::pair<uint32_t, uint16_t>& result)
     {
         result.first = ANY_ADDRESS;
@@ -96,9 +131,8 @@ namespace relay
     }
 
     Socket::Socket(Network& aNetwork):
-        network(aNetwork)
+        network(aNetwork), connectTimer(aNetwork)
     {
-        network.addSocket(*this);
     }
 
     Socket::Socket(Network& aNetwork, socket_t aSocketFd, bool aReady,
@@ -106,16 +140,15 @@ namespace relay
                    uint32_t aRemoteIPAddress, uint16_t aRemotePort):
         network(aNetwork), socketFd(aSocketFd), ready(aReady),
         localIPAddress(aLocalIPAddress), localPort(aLocalPort),
-        remoteIPAddress(aRemoteIPAddress), remotePort(aRemotePort)
+        remoteIPAddress(aRemoteIPAddress), remotePort(aRemotePort),
+        connectTimer(aNetwork)
     {
         remoteAddressString = ipToString(remoteIPAddress) + ":" + std::to_string(remotePort);
-        network.addSocket(*this);
+        if (socketFd != INVALID_SOCKET) network.addSocketFd(*this);
     }
 
     Socket::~Socket()
     {
-        network.removeSocket(*this);
-
         writeData();
         closeSocketFd();
     }
@@ -129,17 +162,37 @@ namespace relay
         remoteIPAddress(other.remoteIPAddress),
         remotePort(other.remotePort),
         connectTimeout(other.connectTimeout),
-        timeSinceConnect(other.timeSinceConnect),
+        connectTimer(other.network),
+        reusePort(other.reusePort),
+        options(other.options),
         accepting(other.accepting),
         connecting(other.connecting),
+        writeInterest(other.writeInterest),
+        flushPending(other.flushPending),
         readCallback(std::move(other.readCallback)),
         closeCallback(std::move(other.closeCallback)),
         acceptCallback(std::move(other.acceptCallback)),
         connectCallback(std::move(other.connectCallback)),
         connectErrorCallback(std::move(other.connectErrorCallback)),
-        outData(std::move(other.outData))
+        writeCallback(std::move(other.writeCallback)),
+        inData(std::move(other.inData)),
+        outData(std::move(other.outData)),
+        outDataSize(other.outDataSize),
+        sentSize(other.sentSize),
+        receivedSize(other.receivedSize),
+        traceId(other.traceId),
+        zeroCopyThreshold(other.zeroCopyThreshold),
+        zeroCopyEnabled(other.zeroCopyEnabled),
+        zeroCopyId(other.zeroCopyId),
+        zeroCopySends(std::move(other.zeroCopySends)),
+        ringSendId(other.ringSendId)
     {
-        network.addSocket(*this);
+        if (socketFd != INVALID_SOCKET) network.addSocketFd(*this);
+
+        if (connecting)
+        {
+            connectTimer.start(connectTimeout, std::bind(&Socket::handleConnectTimeout, this, std::placeholders::_1));
+        }
 
         remoteAddressString = ipToString(remoteIPAddress) + ":" + std::to_string(remotePort);
 
@@ -150,8 +203,14 @@ namespace relay
         other.remoteIPAddress = 0;
         other.remotePort = 0;
         other.connecting = false;
+        other.writeInterest = false;
+        other.flushPending = false;
+        other.zeroCopyEnabled = false;
+        other.zeroCopyId = 0;
+        other.zeroCopySends.clear();
+        other.ringSendId = 0;
         other.connectTimeout = 10.0f;
-        other.timeSinceConnect = 0.0f;
+        other.connectTimer.stop();
     }
 
     Socket& Socket::operator=(Socket&& other)
@@ -165,15 +224,40 @@ namespace relay
         remoteIPAddress = other.remoteIPAddress;
         remotePort = other.remotePort;
         connectTimeout = other.connectTimeout;
-        timeSinceConnect = other.timeSinceConnect;
+        reusePort = other.reusePort;
+        options = other.options;
         accepting = other.accepting;
         connecting = other.connecting;
+        writeInterest = other.writeInterest;
+        flushPending = other.flushPending;
         readCallback = std::move(other.readCallback);
         closeCallback = std::move(other.closeCallback);
         acceptCallback = std::move(other.acceptCallback);
         connectCallback = std::move(other.connectCallback);
         connectErrorCallback = std::move(other.connectErrorCallback);
+        writeCallback = std::move(other.writeCallback);
+        inData = std::move(other.inData);
         outData = std::move(other.outData);
+        outDataSize = other.outDataSize;
+        sentSize = other.sentSize;
+        receivedSize = other.receivedSize;
+        traceId = other.traceId;
+        zeroCopyThreshold = other.zeroCopyThreshold;
+        zeroCopyEnabled = other.zeroCopyEnabled;
+        zeroCopyId = other.zeroCopyId;
+        zeroCopySends = std::move(other.zeroCopySends);
+        ringSendId = other.ringSendId;
+
+        if (socketFd != INVALID_SOCKET) network.addSocketFd(*this);
+
+        if (connecting)
+        {
+            connectTimer.start(connectTimeout, std::bind(&Socket::handleConnectTimeout, this, std::placeholders::_1));
+        }
+        else
+        {
+            connectTimer.stop();
+        }
 
         remoteAddressString = ipToString(remoteIPAddress) + ":" + std::to_string(remotePort);
 
@@ -185,8 +269,14 @@ namespace relay
         other.remotePort = 0;
         other.accepting = false;
         other.connecting = false;
+        other.writeInterest = false;
+        other.flushPending = false;
+        other.zeroCopyEnabled = false;
+        other.zeroCopyId = 0;
+        other.zeroCopySends.clear();
+        other.ringSendId = 0;
         other.connectTimeout = 10.0f;
-        other.timeSinceConnect = 0.0f;
+        other.connectTimer.stop();
 
         return *this;
     }
@@ -215,30 +305,85 @@ namespace relay
         ready = false;
         accepting = false;
         connecting = false;
+        connectTimer.stop();
         outData.clear();
+        outDataSize = 0;
         inData.clear();
 
         return result;
     }
 
-    void Socket::update(float delta)
+    socket_t Socket::release(std::vector<uint8_t>& pendingData)
     {
-        if (connecting)
+        socket_t result = socketFd;
+
+        if (socketFd != INVALID_SOCKET)
         {
-            timeSinceConnect += delta;
+            if (!zeroCopySends.empty()) readZeroCopyCompletions();
 
-            if (timeSinceConnect > connectTimeout)
+            // handovers happen before an output gets the zero copy threshold of its endpoint, so this is not expected,
+            // but the completions would go to the new owner of the descriptor and the buffers could not be released
+            if (!zeroCopySends.empty())
             {
-                connecting = false;
+                Log(Log::Level::WARN) << "Socket " << remoteAddressString << " has unfinished zero copy sends, not releasing it";
+                return INVALID_SOCKET;
+            }
 
-                close();
+#ifdef HAVE_IO_URING
+            // the new owner continues after the data that the ring has sent
+            if (ringSendId != 0)
+            {
+                int size = network.waitRingSend(ringSendId);
+                ringSendId = 0;
 
-                Log(Log::Level::WARN) << "Failed to connect to " << remoteAddressString << ", connection timed out";
+                if (size > 0) consumeOutData(static_cast<size_t>(size));
+            }
+#endif
 
-                if (connectErrorCallback)
-                {
-                    connectErrorCallback(*this);
-                }
+            network.removeSocketFd(*this);
+
+            socketFd = INVALID_SOCKET;
+            zeroCopyEnabled = false;
+            zeroCopyId = 0;
+        }
+
+        pendingData.clear();
+
+        for (const OutSegment& segment : outData)
+        {
+            pendingData.insert(pendingData.end(),
+                               segment.buffer.getData() + segment.offset,
+                               segment.buffer.getData() + segment.offset + segment.size);
+        }
+
+        localIPAddress = 0;
+        localPort = 0;
+        remoteIPAddress = 0;
+        remotePort = 0;
+        ready = false;
+        accepting = false;
+        connecting = false;
+        connectTimer.stop();
+        outData.clear();
+        outDataSize = 0;
+        inData.clear();
+
+        return result;
+    }
+
+    void Socket::handleConnectTimeout(Timer&)
+    {
+        if (connecting)
+        {
+            connecting = false;
+
+            close();
+
+            Log(Log::Level::WARN) << "Failed to connect to " << remoteAddressString << ", connection timed out";
+
+            if (connectErrorCallback)
+            {
+                connectErrorCallback(*this);
             }
         }
     }
@@ -284,6 +429,9 @@ namespace relay
             return false;
         }
 
+        // before listen, so that the window scale of the accepted sockets fits the buffer sizes
+        applyOptions(true);
+
         localIPAddress = address;
         localPort = newPort;
         int value = 1;
@@ -292,9 +440,27 @@ namespace relay
         {
             int error = getLastError();
             Log(Log::Level::ERR) << "setsockopt(SO_REUSEADDR) failed, error: " << error;
+            closeSocketFd();
             return false;
         }
 
+        if (reusePort)
+        {
+#ifdef SO_REUSEPORT
+            if (setsockopt(socketFd, SOL_SOCKET, SO_REUSEPORT, reinterpret_cast<const char*>(&value), sizeof(value)) < 0)
+            {
+                int error = getLastError();
+                Log(Log::Level::ERR) << "setsockopt(SO_REUSEPORT) failed, error: " << error;
+                closeSocketFd();
+                return false;
+            }
+#else
+            Log(Log::Level::ERR) << "SO_REUSEPORT is not supported";
+            closeSocketFd();
+            return false;
+#endif
+        }
+
         sockaddr_in serverAddress;
         memset(&serverAddress, 0, sizeof(serverAddress));
         serverAddress.sin_family = AF_INET;
@@ -305,21 +471,26 @@ namespace relay
         {
             int error = getLastError();
             Log(Log::Level::ERR) << "Failed to bind server socket to port " << localPort << ", error: " << error;
+            closeSocketFd();
             return false;
         }
 
-        if (listen(socketFd, WAITING_QUEUE_SIZE) < 0)
+        if (listen(socketFd, static_cast<int>(options.listenBacklog)) < 0)
         {
             int error = getLastError();
             Log(Log::Level::ERR) << "Failed to listen on " << ipToString(localIPAddress) << ":" << localPort << ", error: " << error;
+            closeSocketFd();
             return false;
         }
 
-        Log(Log::Level::INFO) << "Server listening on " << ipToString(localIPAddress) << ":" << localPort;
+        RELAY_LOG(Log::Level::INFO) << "Server listening on " << ipToString(localIPAddress) << ":" << localPort;
         
         accepting = true;
         ready = true;
-        
+
+        // the io_uring backend accepts the clients in the kernel
+        network.updateSocketFd(*this);
+
         return true;
     }
 
@@ -352,12 +523,15 @@ namespace relay
             return false;
         }
 
+        // before connect, so that the window scale fits the buffer sizes
+        applyOptions(false);
+
         remoteIPAddress = address;
         remotePort = newPort;
 
         remoteAddressString = ipToString(remoteIPAddress) + ":" + std::to_string(remotePort);
 
-        Log(Log::Level::INFO) << "Connecting to " << remoteAddressString;
+        RELAY_LOG(Log::Level::INFO) << "Connecting to " << remoteAddressString;
 
         sockaddr_in addr;
         memset(&addr, 0, sizeof(addr));
@@ -376,6 +550,8 @@ namespace relay
 #endif
                 {
                     connecting = true;
+                    updateWriteInterest();
+                    connectTimer.start(connectTimeout, std::bind(&Socket::handleConnectTimeout, this, std::placeholders::_1));
                 }
                 else
                 {
@@ -391,7 +567,7 @@ namespace relay
         {
             // connected
             ready = true;
-            Log(Log::Level::INFO) << "Socket connected to " << remoteAddressString;
+            RELAY_LOG(Log::Level::INFO) << "Socket connected to " << remoteAddressString;
             if (connectCallback)
             {
                 connectCallback(*this);
@@ -407,6 +583,7 @@ namespace relay
             Log(Log::Level::WARN) << "Failed to get address of the socket connecting to " << remoteAddressString << ", error: " << error;
             closeSocketFd();
             connecting = false;
+            connectTimer.stop();
             if (connectErrorCallback)
             {
                 connectErrorCallback(*this);
@@ -425,7 +602,19 @@ namespace relay
         connectTimeout = timeout;
     }
 
-    void Socket::setReadCallback(const std::function<void(Socket&, const std::vector<uint8_t>&)>& newReadCallback)
+    void Socket::setReusePort(bool newReusePort)
+    {
+        reusePort = newReusePort;
+    }
+
+    void Socket::setOptions(const Options& newOptions)
+    {
+        options = newOptions;
+
+        if (socketFd != INVALID_SOCKET) applyOptions(accepting);
+    }
+
+    void Socket::setReadCallback(const std::function<void(Socket&, ByteQueue&)>& newReadCallback)
     {
         readCallback = newReadCallback;
     }
@@ -450,6 +639,80 @@ namespace relay
         connectErrorCallback = newConnectErrorCallback;
     }
 
+    void Socket::setWriteCallback(const std::function<void(Socket&)>& newWriteCallback)
+    {
+        writeCallback = newWriteCallback;
+    }
+
+    static bool setOption(socket_t socketFd, int level, int name, int value, const char* optionName)
+    {
+        if (setsockopt(socketFd, level, name, reinterpret_cast<const char*>(&value), sizeof(value)) < 0)
+        {
+            int error = getLastError();
+            Log(Log::Level::WARN) << "setsockopt(" << optionName << ") failed, error: " << error;
+            return false;
+        }
+
+        return true;
+    }
+
+    bool Socket::applyOptions(bool listening)
+    {
+        bool result = true;
+
+        // listening sockets only need the buffer sizes, the accepted sockets get the rest
+        if (!listening)
+        {
+            if (options.noDelay && !setOption(socketFd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY")) result = false;
+
+            if (options.keepAlive)
+            {
+                if (!setOption(socketFd, SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE")) result = false;
+
+#if defined(TCP_KEEPIDLE)
+                if (options.keepAliveIdle > 0 &&
+                    !setOption(socketFd, IPPROTO_TCP, TCP_KEEPIDLE, static_cast<int>(options.keepAliveIdle), "TCP_KEEPIDLE")) result = false;
+#elif defined(TCP_KEEPALIVE)
+                if (options.keepAliveIdle > 0 &&
+                    !setOption(socketFd, IPPROTO_TCP, TCP_KEEPALIVE, static_cast<int>(options.keepAliveIdle), "TCP_KEEPALIVE")) result = false;
+#endif
+#ifdef TCP_KEEPINTVL
+                if (options.keepAliveInterval > 0 &&
+                    !setOption(socketFd, IPPROTO_TCP, TCP_KEEPINTVL, static_cast<int>(options.keepAliveInterval), "TCP_KEEPINTVL")) result = false;
+#endif
+#ifdef TCP_KEEPCNT
+                if (options.keepAliveCount > 0 &&
+                    !setOption(socketFd, IPPROTO_TCP, TCP_KEEPCNT, static_cast<int>(options.keepAliveCount), "TCP_KEEPCNT")) result = false;
+#endif
+            }
+
+            if (options.notSentLowWatermark > 0)
+            {
+#ifdef TCP_NOTSENT_LOWAT
+                if (!setOption(socketFd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, static_cast<int>(options.notSentLowWatermark), "TCP_NOTSENT_LOWAT")) result = false;
+#else
+                Log(Log::Level::WARN) << "TCP_NOTSENT_LOWAT is not supported";
+#endif
+            }
+
+            if (options.userTimeout > 0)
+            {
+#ifdef TCP_USER_TIMEOUT
+                if (!setOption(socketFd, IPPROTO_TCP, TCP_USER_TIMEOUT, static_cast<int>(options.userTimeout), "TCP_USER_TIMEOUT")) result = false;
+#else
+                Log(Log::Level::WARN) << "TCP_USER_TIMEOUT is not supported";
+#endif
+            }
+        }
+
+        if (options.sendBufferSize > 0 &&
+            !setOption(socketFd, SOL_SOCKET, SO_SNDBUF, static_cast<int>(options.sendBufferSize), "SO_SNDBUF")) result = false;
+        if (options.receiveBufferSize > 0 &&
+            !setOption(socketFd, SOL_SOCKET, SO_RCVBUF, static_cast<int>(options.receiveBufferSize), "SO_RCVBUF")) result = false;
+
+        return result;
+    }
+
     bool Socket::createSocketFd()
     {
         socketFd = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
@@ -471,18 +734,8 @@ namespace relay
         }
 
         // set socket to non-blocking
-#ifdef _WIN32
-        unsigned long mode = 1;
-        if (ioctlsocket(socketFd, FIONBIO, &mode) != 0)
+        if (!setNonBlocking(socketFd))
             return false;
-#else
-        int flags = fcntl(socketFd, F_GETFL, 0);
-        if (flags < 0) return false;
-        flags |= O_NONBLOCK;
-
-        if (fcntl(socketFd, F_SETFL, flags) != 0)
-            return false;
-#endif
 
 #ifdef __APPLE__
         int set = 1;
@@ -494,6 +747,10 @@ namespace relay
         }
 #endif
 
+        if (zeroCopyThreshold > 0) enableZeroCopy();
+
+        network.addSocketFd(*this);
+
         return true;
     }
 
@@ -501,12 +758,44 @@ namespace relay
     {
         if (socketFd != INVALID_SOCKET)
         {
+            if (!zeroCopySends.empty()) readZeroCopyCompletions();
+            network.removeSocketFd(*this);
+
+            int result = 0;
+
+#ifdef HAVE_ZERO_COPY
+            if (!zeroCopySends.empty())
+            {
+                // the kernel still reads the buffers of the sends that it has not completed,
+                // so the descriptor stays open until it reports them, and only the sending side is shut down
+                if (::shutdown(socketFd, SHUT_WR) < 0 && getLastError() != ENOTCONN)
+                {
+                    int error = getLastError();
+                    Log(Log::Level::WARN) << "Failed to shut down socket " << ipToString(localIPAddress) << ":" << localPort << ", error: " << error;
+                }
+
+                // a peer that does not acknowledge the data would otherwise keep the descriptor forever
+                if (options.userTimeout == 0)
+                {
+                    setOption(socketFd, IPPROTO_TCP, TCP_USER_TIMEOUT, static_cast<int>(ZERO_COPY_LINGER_TIMEOUT), "TCP_USER_TIMEOUT");
+                }
+
+                network.lingerSocketFd(socketFd, std::move(zeroCopySends));
+                zeroCopySends.clear();
+            }
+            else
+#endif
+            {
 #ifdef _WIN32
-            int result = closesocket(socketFd);
+                result = closesocket(socketFd);
 #else
-            int result = ::close(socketFd);
+                result = ::close(socketFd);
 #endif
+            }
+
             socketFd = INVALID_SOCKET;
+            zeroCopyEnabled = false;
+            zeroCopyId = 0;
 
             if (result < 0)
             {
@@ -516,7 +805,7 @@ namespace relay
             }
             else
             {
-                Log(Log::Level::INFO) << "Socket " << ipToString(localIPAddress) << ":" << localPort << " closed";
+                RELAY_LOG(Log::Level::INFO) << "Socket " << ipToString(localIPAddress) << ":" << localPort << " closed";
             }
         }
 
@@ -530,7 +819,42 @@ namespace relay
             return false;
         }
 
-        outData.insert(outData.end(), buffer.begin(), buffer.end());
+        if (buffer.empty()) return true;
+
+        size_t size = buffer.size();
+
+        return send(Buffer(std::move(buffer)), 0, size);
+    }
+
+    bool Socket::send(const Buffer& buffer, size_t offset, size_t size)
+    {
+        if (socketFd == INVALID_SOCKET)
+        {
+            return false;
+        }
+
+        if (size == 0) return true;
+
+        OutSegment segment;
+        segment.buffer = buffer;
+        segment.offset = offset;
+        segment.size = size;
+        outData.push_back(std::move(segment));
+        outDataSize += size;
+
+        // sent at the end of the loop iteration together with the rest of the data that is queued until then
+        if (ready && !connecting && !writeInterest)
+        {
+            if (!flushPending)
+            {
+                flushPending = true;
+                network.addFlush(*this);
+            }
+        }
+        else
+        {
+            updateWriteInterest();
+        }
 
         return true;
     }
@@ -568,22 +892,45 @@ namespace relay
             }
             else
             {
-                Log(Log::Level::INFO) << "Client connected from " << ipToString(address.sin_addr.s_addr) << ":" << ntohs(address.sin_port) << " to " << ipToString(localIPAddress) << ":" << localPort;
-
-                Socket socket(network, clientFd, true,
-                              localIPAddress, localPort,
-                              address.sin_addr.s_addr,
-                              ntohs(address.sin_port));
-                
-                if (acceptCallback)
+                // the accepted socket does not inherit the non-blocking mode on all platforms, but it is read until drained
+                if (!setNonBlocking(clientFd))
                 {
-                    acceptCallback(*this, socket);
+                    int error = getLastError();
+                    Log(Log::Level::ERR) << "Failed to set accepted socket to non-blocking, error: " << error;
+#ifdef _WIN32
+                    closesocket(clientFd);
+#else
+                    ::close(clientFd);
+#endif
+                    return false;
                 }
+
+                return acceptFd(clientFd, address.sin_addr.s_addr, ntohs(address.sin_port));
             }
         }
         else
         {
-            return readData();
+            // poll reports the notifications in the error queue as errors
+            bool completions = !zeroCopySends.empty() && readZeroCopyCompletions();
+
+            return readData(!completions);
+        }
+
+        return true;
+    }
+
+    bool Socket::acceptFd(socket_t clientFd, uint32_t clientIPAddress, uint16_t clientPort)
+    {
+        RELAY_LOG(Log::Level::INFO) << "Client connected from " << ipToString(clientIPAddress) << ":" << clientPort << " to " << ipToString(localIPAddress) << ":" << localPort;
+
+        Socket socket(network, clientFd, true,
+                      localIPAddress, localPort,
+                      clientIPAddress, clientPort);
+        socket.setOptions(options);
+
+        if (acceptCallback)
+        {
+            acceptCallback(*this, socket);
         }
 
         return true;
@@ -594,8 +941,9 @@ namespace relay
         if (connecting)
         {
             connecting = false;
+            connectTimer.stop();
             ready = true;
-            Log(Log::Level::INFO) << "Socket connected to " << remoteAddressString;
+            RELAY_LOG(Log::Level::INFO) << "Socket connected to " << remoteAddressString;
             if (connectCallback)
             {
                 connectCallback(*this);
@@ -605,7 +953,7 @@ namespace relay
         return writeData();
     }
 
-    bool Socket::readData()
+    bool Socket::readData(bool expectData)
     {
 #if defined(__APPLE__)
         int flags = 0;
@@ -615,66 +963,95 @@ namespace relay
         int flags = MSG_NOSIGNAL;
 #endif
 
+        size_t readSize = 0;
+        bool closed = false;
+
+        // read into the end of the queued data until the socket is drained or the budget is used
+        while (readSize < READ_BUDGET)
+        {
+            uint8_t* tail = inData.prepare(READ_SIZE);
+
 #ifdef _WIN32
-        int size = recv(socketFd, reinterpret_cast<char*>(TEMP_BUFFER), sizeof(TEMP_BUFFER), flags);
+            int size = recv(socketFd, reinterpret_cast<char*>(tail), static_cast<int>(READ_SIZE), flags);
 #else
-        ssize_t size = recv(socketFd, reinterpret_cast<char*>(TEMP_BUFFER), sizeof(TEMP_BUFFER), flags);
+            ssize_t size = recv(socketFd, reinterpret_cast<char*>(tail), READ_SIZE, flags);
 #endif
 
-        if (size < 0)
-        {
-            int error = getLastError();
+            inData.commit(size > 0 ? static_cast<size_t>(size) : 0);
+
+            if (size < 0)
+            {
+                int error = getLastError();
 
-            if (error == EAGAIN ||
+                if (error == EAGAIN ||
 #ifdef _WIN32
-                error == WSAEWOULDBLOCK ||
+                    error == WSAEWOULDBLOCK ||
 #endif
-                error == EWOULDBLOCK)
-            {
-                Log(Log::Level::WARN) << "Nothing to read from " << remoteAddressString;
-                return true;
-            }
-            else if (error == ECONNRESET)
-            {
-                Log(Log::Level::INFO) << "Connection to " << remoteAddressString << " reset by peer";
-                disconnected();
-                return false;
-            }
-            else if (error == ECONNREFUSED)
-            {
-                Log(Log::Level::INFO) << "Connection to " << remoteAddressString << " refused";
-                disconnected();
-                return false;
+                    error == EWOULDBLOCK)
+                {
+                    if (readSize == 0 && expectData) Log(Log::Level::WARN) << "Nothing to read from " << remoteAddressString;
+                    break;
+                }
+                else if (error == ECONNRESET)
+                {
+                    RELAY_LOG(Log::Level::INFO) << "Connection to " << remoteAddressString << " reset by peer";
+                    disconnected();
+                    return false;
+                }
+                else if (error == ECONNREFUSED)
+                {
+                    RELAY_LOG(Log::Level::INFO) << "Connection to " << remoteAddressString << " refused";
+                    disconnected();
+                    return false;
+                }
+                else
+                {
+                    Log(Log::Level::ERR) << "Failed to read from " << remoteAddressString << ", error: " << error;
+                    disconnected();
+                    return false;
+                }
             }
-            else
+            else if (size == 0)
             {
-                Log(Log::Level::ERR) << "Failed to read from " << remoteAddressString << ", error: " << error;
-                disconnected();
-                return false;
+                closed = true;
+                break;
             }
-        }
-        else if (size == 0)
-        {
-            disconnected();
 
-            return true;
+            readSize += static_cast<size_t>(size);
+
+            // a short read means that the socket is drained, so the call that would fail with EAGAIN is skipped
+            if (static_cast<size_t>(size) < READ_SIZE) break;
         }
 
-        Log(Log::Level::ALL) << "Socket received " << size << " bytes from " << remoteAddressString;
+        if (readSize > 0)
+        {
+            receivedSize += readSize;
 
-        inData.assign(TEMP_BUFFER, TEMP_BUFFER + size);
+            RELAY_LOG(Log::Level::ALL) << "Socket received " << readSize << " bytes from " << remoteAddressString;
 
-        if (readCallback)
-        {
-            readCallback(*this, inData);
+            if (readCallback)
+            {
+                readCallback(*this, inData);
+            }
         }
-        
+
+        // the data that was received before the end of the stream is handled first
+        if (closed) disconnected();
+
         return true;
     }
 
     bool Socket::writeData()
     {
-        if (ready && !outData.empty())
+#ifdef HAVE_IO_URING
+        // the ring sends the data and the rest is queued when the send completes
+        if (network.backend == Network::Backend::IO_URING && queueRingSend()) return true;
+#endif
+
+        bool written = false;
+
+        // continue while the socket accepts everything, as there can be more segments than fit in one call
+        while (ready && !outData.empty())
         {
 #if defined(__APPLE__)
             int flags = 0;
@@ -684,61 +1061,351 @@ namespace relay
             int flags = MSG_NOSIGNAL;
 #endif
 
+            // gather the queued segments, so that shared buffers are sent without copying
+            size_t segmentCount = std::min(outData.size(), MAX_WRITE_SEGMENTS);
+
+#ifdef HAVE_ZERO_COPY
+            // large payloads are sent with zero copy and the small segments between them (like chunk headers) are copied,
+            // so a call only gathers segments of the same kind
+            bool zeroCopy = zeroCopyEnabled && outData[0].size >= zeroCopyThreshold;
+
+            if (zeroCopyEnabled)
+            {
+                for (size_t i = 1; i < segmentCount; ++i)
+                {
+                    if ((outData[i].size >= zeroCopyThreshold) != zeroCopy)
+                    {
+                        segmentCount = i;
+                        break;
+                    }
+                }
+            }
+#endif
+
 #ifdef _WIN32
-            int dataSize = static_cast<int>(outData.size());
-            int size = ::send(socketFd, reinterpret_cast<const char*>(outData.data()), dataSize, flags);
+            WSABUF buffers[MAX_WRITE_SEGMENTS];
+            DWORD dataSize = 0;
+
+            for (size_t i = 0; i < segmentCount; ++i)
+            {
+                buffers[i].buf = reinterpret_cast<char*>(const_cast<uint8_t*>(outData[i].buffer.getData() + outData[i].offset));
+                buffers[i].len = static_cast<ULONG>(outData[i].size);
+                dataSize += buffers[i].len;
+            }
+
+            DWORD sentBytes = 0;
+            int size = (WSASend(socketFd, buffers, static_cast<DWORD>(segmentCount), &sentBytes, flags, nullptr, nullptr) == SOCKET_ERROR) ? -1 : static_cast<int>(sentBytes);
+#else
+            iovec buffers[MAX_WRITE_SEGMENTS];
+            ssize_t dataSize = 0;
+
+            for (size_t i = 0; i < segmentCount; ++i)
+            {
+                buffers[i].iov_base = const_cast<uint8_t*>(outData[i].buffer.getData() + outData[i].offset);
+                buffers[i].iov_len = outData[i].size;
+                dataSize += static_cast<ssize_t>(outData[i].size);
+            }
+
+            msghdr message;
+            memset(&message, 0, sizeof(message));
+            message.msg_iov = buffers;
+            message.msg_iovlen = segmentCount;
+
+#ifdef HAVE_ZERO_COPY
+            ssize_t size = ::sendmsg(socketFd, &message, flags | (zeroCopy ? MSG_ZEROCOPY : 0));
+
+            // the memory for the notifications ran out, so this data is copied
+            if (size < 0 && zeroCopy && getLastError() == ENOBUFS)
+            {
+                zeroCopy = false;
+                size = ::sendmsg(socketFd, &message, flags);
+            }
 #else
-            ssize_t dataSize = static_cast<ssize_t>(outData.size());
-            ssize_t size = ::send(socketFd, reinterpret_cast<const char*>(outData.data()), outData.size(), flags);
+            ssize_t size = ::sendmsg(socketFd, &message, flags);
+#endif
 #endif
 
             if (size < 0)
             {
-                int error = getLastError();
-                if (error == EAGAIN ||
-#ifdef _WIN32
-                    error == WSAEWOULDBLOCK ||
-#endif
-                    error == EWOULDBLOCK)
-                {
-                    Log(Log::Level::WARN) << "Can not write to " << remoteAddressString << " now";
-                    return true;
-                }
-                else if (error == EPIPE)
-                {
-                    Log(Log::Level::ERR) << "Failed to send data to " << remoteAddressString << ", socket has been shut down";
-                    disconnected();
-                    return false;
-                }
-                else if (error == ECONNRESET)
-                {
-                    Log(Log::Level::INFO) << "Connection to " << remoteAddressString << " reset by peer";
-                    disconnected();
-                    return false;
-                }
-                else
+                // the rest is sent when the socket becomes writable
+                if (handleWriteError(getLastError())) break;
+
+                return false;
+            }
+            else if (size != dataSize)
+            {
+                RELAY_LOG(Log::Level::ALL) << "Socket did not send all data to " << remoteAddressString << ", sent " << size << " out of " << dataSize << " bytes";
+            }
+            else
+            {
+                RELAY_LOG(Log::Level::ALL) << "Socket sent " << size << " bytes to " << remoteAddressString;
+            }
+
+            size_t remaining = static_cast<size_t>(size);
+
+#ifdef HAVE_ZERO_COPY
+            if (zeroCopy && size > 0)
+            {
+                // the kernel reads the sent part of the segments until it reports the completion
+                ZeroCopySend send;
+                send.id = zeroCopyId++;
+
+                size_t covered = 0;
+                for (size_t i = 0; i < segmentCount && covered < remaining; ++i)
                 {
-                    Log(Log::Level::ERR) << "Failed to write to socket " << remoteAddressString << ", error: " << error;
-                    disconnected();
-                    return false;
+                    send.buffers.push_back(outData[i].buffer);
+                    covered += outData[i].size;
                 }
+
+                zeroCopySends.push_back(std::move(send));
             }
-            else if (size != dataSize)
+#endif
+
+            consumeOutData(remaining);
+
+            if (size > 0) written = true;
+            if (static_cast<size_t>(size) != static_cast<size_t>(dataSize)) break;
+        }
+
+        if (written && writeCallback)
+        {
+            writeCallback(*this);
+        }
+
+        // also drops the interest after connecting
+        updateWriteInterest();
+
+        return true;
+    }
+
+    bool Socket::handleWriteError(int error)
+    {
+        if (error == EAGAIN ||
+#ifdef _WIN32
+            error == WSAEWOULDBLOCK ||
+#endif
+            error == EWOULDBLOCK)
+        {
+            RELAY_LOG(Log::Level::ALL) << "Can not write to " << remoteAddressString << " now";
+            return true;
+        }
+        else if (error == EPIPE)
+        {
+            Log(Log::Level::ERR) << "Failed to send data to " << remoteAddressString << ", socket has been shut down";
+        }
+        else if (error == ECONNRESET)
+        {
+            RELAY_LOG(Log::Level::INFO) << "Connection to " << remoteAddressString << " reset by peer";
+        }
+        else
+        {
+            Log(Log::Level::ERR) << "Failed to write to socket " << remoteAddressString << ", error: " << error;
+        }
+
+        disconnected();
+        return false;
+    }
+
+    void Socket::consumeOutData(size_t size)
+    {
+        outDataSize -= size;
+        sentSize += size;
+
+        Trace::record(Trace::Event::SOCKET_WRITTEN, traceId, 0, 0, sentSize, size);
+
+        while (size > 0 && !outData.empty())
+        {
+            OutSegment& segment = outData.front();
+
+            if (size >= segment.size)
             {
-                Log(Log::Level::ALL) << "Socket did not send all data to " << remoteAddressString << ", sent " << size << " out of " << outData.size() << " bytes";
+                size -= segment.size;
+                outData.pop_front();
             }
             else
             {
-                Log(Log::Level::ALL) << "Socket sent " << size << " bytes to " << remoteAddressString;
+                segment.offset += size;
+                segment.size -= size;
+                size = 0;
             }
+        }
+    }
 
-            if (size > 0)
+#ifdef HAVE_IO_URING
+    bool Socket::queueRingSend()
+    {
+        // one send at a time, so that the data is sent in order, and the data after it is queued when it completes
+        if (ringSendId == 0 && ready && !outData.empty())
+        {
+            // without MSG_ZEROCOPY, the kernel copies the data when it issues the send
+            std::unique_ptr<Network::RingSend> send(new Network::RingSend());
+            size_t segmentCount = std::min(outData.size(), MAX_WRITE_SEGMENTS);
+            send->segments.resize(segmentCount);
+            send->buffers.reserve(segmentCount);
+
+            for (size_t i = 0; i < segmentCount; ++i)
             {
-                outData.erase(outData.begin(), outData.begin() + size);
+                send->segments[i].iov_base = const_cast<uint8_t*>(outData[i].buffer.getData() + outData[i].offset);
+                send->segments[i].iov_len = outData[i].size;
+                send->buffers.push_back(outData[i].buffer);
+                send->size += outData[i].size;
             }
+
+            ringSendId = network.addRingSend(socketFd, std::move(send));
+
+            // the ring is full, so the data is written directly
+            if (ringSendId == 0) return false;
         }
-        
+
+        updateWriteInterest();
+
+        return true;
+    }
+
+    bool Socket::ringSendCompleted(int result, size_t size)
+    {
+        ringSendId = 0;
+
+        if (result < 0)
+        {
+            if (!handleWriteError(-result)) return false;
+        }
+        else
+        {
+            size_t sent = static_cast<size_t>(result);
+
+            if (sent != size)
+            {
+                RELAY_LOG(Log::Level::ALL) << "Socket did not send all data to " << remoteAddressString << ", sent " << sent << " out of " << size << " bytes";
+            }
+            else
+            {
+                RELAY_LOG(Log::Level::ALL) << "Socket sent " << sent << " bytes to " << remoteAddressString;
+            }
+
+            consumeOutData(sent);
+
+            if (sent > 0 && writeCallback)
+            {
+                writeCallback(*this);
+            }
+
+            // a short send means that the socket buffer is full, so the rest waits until the socket is writable
+            if (sent == size) return writeData();
+        }
+
+        updateWriteInterest();
+
+        return true;
+    }
+#endif
+
+    void Socket::setZeroCopyThreshold(size_t newZeroCopyThreshold)
+    {
+        zeroCopyThreshold = newZeroCopyThreshold;
+
+        if (zeroCopyThreshold == 0) zeroCopyEnabled = false;
+        else if (socketFd != INVALID_SOCKET && !zeroCopyEnabled) enableZeroCopy();
+    }
+
+    bool Socket::enableZeroCopy()
+    {
+#ifdef HAVE_ZERO_COPY
+        int set = 1;
+        if (setsockopt(socketFd, SOL_SOCKET, SO_ZEROCOPY, &set, sizeof(set)) != 0)
+        {
+            int error = getLastError();
+            Log(Log::Level::WARN) << "Failed to enable zero copy for " << remoteAddressString << ", error: " << error;
+            zeroCopyEnabled = false;
+            return false;
+        }
+
+        zeroCopyEnabled = true;
         return true;
+#else
+        Log(Log::Level::WARN) << "Zero copy is not supported on this platform";
+        return false;
+#endif
+    }
+
+    bool Socket::readZeroCopyCompletions()
+    {
+        bool copied = false;
+        bool result = readZeroCopyCompletions(socketFd, zeroCopySends, copied);
+
+        if (copied && zeroCopyEnabled)
+        {
+            // the kernel had to copy anyway (for example on loopback), so the notifications would only add work
+            RELAY_LOG(Log::Level::INFO) << "Zero copy data to " << remoteAddressString << " was copied, sending with copies";
+            zeroCopyEnabled = false;
+        }
+
+        return result;
+    }
+
+    bool Socket::readZeroCopyCompletions(socket_t socketFd, std::deque<ZeroCopySend>& sends, bool& copied)
+    {
+        bool result = false;
+
+#ifdef HAVE_ZERO_COPY
+        for (;;)
+        {
+            union
+            {
+                char buffer[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in))];
+                cmsghdr align;
+            } control;
+
+            msghdr message;
+            memset(&message, 0, sizeof(message));
+            message.msg_control = control.buffer;
+            message.msg_controllen = sizeof(control.buffer);
+
+            // fails with EAGAIN when the queue is empty
+            if (::recvmsg(socketFd, &message, MSG_ERRQUEUE) < 0) break;
+
+            for (cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header))
+            {
+                if (header->cmsg_level != SOL_IP || header->cmsg_type != IP_RECVERR) continue;
+
+                const sock_extended_err* error = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(header));
+                if (error->ee_origin != SO_EE_ORIGIN_ZEROCOPY || error->ee_errno != 0) continue;
+
+                result = true;
+
+                // the notification covers the sends from the first to the last id
+                uint32_t first = error->ee_info;
+                uint32_t last = error->ee_data;
+
+                for (auto i = sends.begin(); i != sends.end();)
+                {
+                    if (i->id - first <= last - first) i = sends.erase(i);
+                    else ++i;
+                }
+
+                if (error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) copied = true;
+            }
+        }
+#else
+        (void)socketFd;
+        (void)sends;
+        (void)copied;
+#endif
+
+        return result;
+    }
+
+    void Socket::updateWriteInterest()
+    {
+        // the ring reports the completion of a queued send, so the socket is not polled for writing meanwhile
+        bool newWriteInterest = connecting || (!outData.empty() && ringSendId == 0);
+
+        if (newWriteInterest != writeInterest)
+        {
+            writeInterest = newWriteInterest;
+
+            if (socketFd != INVALID_SOCKET) network.updateSocketFd(*this);
+        }
     }
 
     bool Socket::disconnected()
@@ -748,6 +1415,7 @@ namespace relay
         if (connecting)
         {
             connecting = false;
+            connectTimer.stop();
             ready = false;
 
             Log(Log::Level::WARN) << "Failed to connect to " << remoteAddressString;
@@ -769,7 +1437,7 @@ namespace relay
         {
             if (ready)
             {
-                Log(Log::Level::INFO) << "Socket disconnected from " << remoteAddressString << " disconnected";
+                RELAY_LOG(Log::Level::INFO) << "Socket disconnected from " << remoteAddressString << " disconnected";
 
                 ready = false;
 
@@ -791,7 +1459,9 @@ namespace relay
                 remoteIPAddress = 0;
                 remotePort = 0;
                 ready = false;
+                inData.clear();
                 outData.clear();
+                outDataSize = 0;
             }
         }
 
@@ -4,10 +4,14 @@
 
 #pragma once
 
+#include <deque>
 #include <vector>
 #include <functional>
 #include <cstdint>
 #include <string>
+#include "Buffer.hpp"
+#include "ByteQueue.hpp"
+#include "Timer.hpp"
 
 #ifdef _WIN32
 #  define WIN32_LEAN_AND_MEAN
@@ -54,7 +58,25 @@ namespace relay
     public:
         static bool getAddress(const std::string& address, std::pair<uint32_t, uint16_t>& result);
 
+        // TCP tuning, the values that are 0 keep the defaults of the system
+        struct Options
+        {
+            bool noDelay = false;
+            uint32_t sendBufferSize = 0; // bytes
+            uint32_t receiveBufferSize = 0; // bytes
+            uint32_t listenBacklog = 128;
+            bool keepAlive = false;
+            uint32_t keepAliveIdle = 0; // seconds
+            uint32_t keepAliveInterval = 0; // seconds
+            uint32_t keepAliveCount = 0;
+            uint32_t notSentLowWatermark = 0; // bytes, Linux and macOS only
+            uint32_t userTimeout = 0; // milliseconds, Linux only
+        };
+
         Socket(Network& aNetwork);
+        Socket(Network& aNetwork, socket_t aSocketFd, bool aReady,
+               uint32_t aLocalIPAddress, uint16_t aLocalPort,
+               uint32_t aRemoteIPAddress, uint16_t aRemotePort);
         virtual ~Socket();
 
         Socket(const Socket&) = delete;
@@ -64,7 +86,10 @@ namespace relay
         Socket& operator=(Socket&& other);
 
         bool close(bool forceClose = false);
-        void update(float delta);
+
+        // detaches the descriptor from the network without closing it, so that it can be moved to another network,
+        // returns INVALID_SOCKET and keeps the descriptor if the kernel still reads the buffers of zero copy sends
+        socket_t release(std::vector<uint8_t>& pendingData);
 
         bool startRead();
 
@@ -76,14 +101,23 @@ namespace relay
 
         bool isConnecting() const { return connecting; }
         void setConnectTimeout(float timeout);
+        void setReusePort(bool newReusePort);
+        // applied to the open descriptor and to the ones created later
+        void setOptions(const Options& newOptions);
+        const Options& getOptions() const { return options; }
 
-        void setReadCallback(const std::function<void(Socket&, const std::vector<uint8_t>&)>& newReadCallback);
+        // the callback gets the received data that was not consumed yet and consumes the part that it handled
+        void setReadCallback(const std::function<void(Socket&, ByteQueue&)>& newReadCallback);
         void setCloseCallback(const std::function<void(Socket&)>& newCloseCallback);
         void setAcceptCallback(const std::function<void(Socket&, Socket&)>& newAcceptCallback);
         void setConnectCallback(const std::function<void(Socket&)>& newConnectCallback);
         void setConnectErrorCallback(const std::function<void(Socket&)>& newConnectErrorCallback);
+        // called after queued data was sent
+        void setWriteCallback(const std::function<void(Socket&)>& newWriteCallback);
 
         bool send(std::vector<uint8_t> buffer);
+        // queues a part of the shared buffer without copying it
+        bool send(const Buffer& buffer, size_t offset, size_t size);
 
         uint32_t getLocalIPAddress() const { return localIPAddress; }
         uint16_t getLocalPort() const { return localPort; }
@@ -94,20 +128,59 @@ namespace relay
         bool isReady() const { return ready; }
 
         bool hasOutData() const { return !outData.empty(); }
+        // bytes waiting to be sent and bytes sent since the socket was created
+        size_t getOutDataSize() const { return outDataSize; }
+        uint64_t getSentSize() const { return sentSize; }
+        uint64_t getReceivedSize() const { return receivedSize; }
+
+        // received data that was not consumed yet
+        ByteQueue& getInData() { return inData; }
+
+        // id of the owner in the trace
+        void setTraceId(uint64_t newTraceId) { traceId = newTraceId; }
+
+        // sends with MSG_ZEROCOPY when a queued segment has at least this many bytes (0 to disable, Linux only)
+        void setZeroCopyThreshold(size_t newZeroCopyThreshold);
 
     protected:
-        Socket(Network& aNetwork, socket_t aSocketFd, bool aReady,
-               uint32_t aLocalIPAddress, uint16_t aLocalPort,
-               uint32_t aRemoteIPAddress, uint16_t aRemotePort);
+        // buffers of a MSG_ZEROCOPY send, kept until the kernel has completed it
+        struct ZeroCopySend
+        {
+            uint32_t id;
+            std::vector<Buffer> buffers;
+        };
 
         bool read();
         bool write();
 
-        bool readData();
+        // warns if there was nothing to read
+        bool readData(bool expectData = true);
         bool writeData();
+        // takes over a client that was accepted on this socket
+        bool acceptFd(socket_t clientFd, uint32_t clientIPAddress, uint16_t clientPort);
+        // returns false if the error closed the socket
+        bool handleWriteError(int error);
+        // removes the sent bytes from the out data
+        void consumeOutData(size_t size);
+
+        // queues a send of the out data in the io_uring ring, returns false if the ring could not take it
+        bool queueRingSend();
+        bool ringSendCompleted(int result, size_t size);
+
+        bool enableZeroCopy();
+        // releases the buffers of the sends that the kernel has completed, returns true if there were notifications
+        bool readZeroCopyCompletions();
+        // copied is set if the kernel reported that it had to copy the data
+        static bool readZeroCopyCompletions(socket_t socketFd, std::deque<ZeroCopySend>& sends, bool& copied);
 
         bool disconnected();
 
+        void updateWriteInterest();
+
+        void handleConnectTimeout(Timer& timer);
+
+        bool applyOptions(bool listening);
+
         bool createSocketFd();
         bool closeSocketFd();
 
@@ -124,18 +197,41 @@ namespace relay
         uint16_t remotePort = 0;
 
         float connectTimeout = 10.0f;
-        float timeSinceConnect = 0.0f;
+        Timer connectTimer;
+        bool reusePort = false;
+        Options options;
         bool accepting = false;
         bool connecting = false;
+        bool writeInterest = false;
+        bool flushPending = false; // queued for the flush at the end of the loop iteration
 
-        std::function<void(Socket&, const std::vector<uint8_t>&)> readCallback;
+        std::function<void(Socket&, ByteQueue&)> readCallback;
         std::function<void(Socket&)> closeCallback;
         std::function<void(Socket&, Socket&)> acceptCallback;
         std::function<void(Socket&)> connectCallback;
         std::function<void(Socket&)> connectErrorCallback;
-
-        std::vector<uint8_t> inData;
-        std::vector<uint8_t> outData;
+        std::function<void(Socket&)> writeCallback;
+
+        struct OutSegment
+        {
+            Buffer buffer;
+            size_t offset;
+            size_t size;
+        };
+
+        ByteQueue inData;
+        std::deque<OutSegment> outData;
+        size_t outDataSize = 0;
+        uint64_t sentSize = 0;
+        uint64_t receivedSize = 0;
+        uint64_t traceId = 0;
+
+        size_t zeroCopyThreshold = 0;
+        bool zeroCopyEnabled = false; // SO_ZEROCOPY is set and the kernel did not fall back to copying
+        uint32_t zeroCopyId = 0; // id of the next send, counted by the kernel for each descriptor
+        std::deque<ZeroCopySend> zeroCopySends;
+
+        uint64_t ringSendId = 0; // user data of the io_uring send that has not completed yet
 
         std::string remoteAddressString;
     };
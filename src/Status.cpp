@@ -17,7 +17,7 @@ namespace relay
         socket.startAccept(address);
     }
 
-    void Status::update(float)
+    void Status::update()
     {
         for (auto i = statusSenders.begin(); i != statusSenders.end();)
         {
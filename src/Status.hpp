@@ -4,7 +4,10 @@
 
 #pragma once
 
+#include <functional>
 #include <memory>
+#include <string>
+#include <vector>
 #include "StatusSender.hpp"
 
 namespace relay
@@ -18,6 +21,15 @@ namespace relay
         JSON
     };
 
+    // reports of the workers, collected on their own threads
+    struct StatsReport
+    {
+        ReportType reportType;
+        std::vector<std::string> stats; // of each worker, the requesting relay first
+        size_t pending = 0; // workers that have not reported yet
+        std::function<void()> completeCallback; // called on the thread of the requesting relay
+    };
+
     class Status
     {
     public:
@@ -28,7 +40,7 @@ namespace relay
         Status(Status&& other) = delete;
         Status& operator=(Status&& other) = delete;
 
-        void update(float delta);
+        void update();
 
     private:
         void handleAccept(Socket& acceptor, Socket& clientSocket);
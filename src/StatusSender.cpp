@@ -4,28 +4,43 @@
 
 #include <algorithm>
 #include "StatusSender.hpp"
+#include "Metrics.hpp"
 #include "Relay.hpp"
 #include "Utils.hpp"
 #include "Log.hpp"
 
 namespace relay
 {
+    // seconds to wait for the reports of the workers
+    static const float STATS_TIMEOUT = 1.0f;
+
     StatusSender::StatusSender(Network& aNetwork,
                                Socket& aSocket,
                                Relay& aRelay):
         network(aNetwork),
         socket(std::move(aSocket)),
-        relay(aRelay)
+        relay(aRelay),
+        statsTimer(aNetwork)
     {
         socket.setReadCallback(std::bind(&StatusSender::handleRead, this, std::placeholders::_1, std::placeholders::_2));
         socket.setCloseCallback(std::bind(&StatusSender::handleClose, this, std::placeholders::_1));
     }
 
-    void StatusSender::handleRead(Socket&, const std::vector<uint8_t>& newData)
+    StatusSender::~StatusSender()
+    {
+        // the workers can still report after the client has disconnected
+        if (statsReport) statsReport->completeCallback = nullptr;
+    }
+
+    void StatusSender::handleRead(Socket&, ByteQueue& newData)
     {
         const std::vector<uint8_t> clrf = {'\r', '\n'};
 
-        data.insert(data.end(), newData.begin(), newData.end());
+        data.insert(data.end(), newData.getData(), newData.getData() + newData.getSize());
+        newData.consume(newData.getSize());
+
+        // the report of the request is still being collected
+        if (statsReport) return;
 
         for (;;)
         {
@@ -42,8 +57,11 @@ namespace relay
             {
                 if (!startLine.empty()) // received header
                 {
-                    sendReport();
-                    socket.close();
+                    if (sendReport())
+                    {
+                        socket.close();
+                        relay.cleanup();
+                    }
                     break;
                 }
             }
@@ -65,9 +83,10 @@ namespace relay
 
     void StatusSender::handleClose(Socket&)
     {
+        relay.cleanup();
     }
 
-    void StatusSender::sendReport()
+    bool StatusSender::sendReport()
     {
         std::vector<std::string> fields;
         tokenize(startLine, fields);
@@ -76,55 +95,23 @@ namespace relay
         {
             if (fields[1] == "/stats" || fields[1] == "/stats.html")
             {
-                std::string info;
-                relay.getStats(info, ReportType::HTML);
-
-                std::string response = "HTTP/1.1 200 OK\r\n"
-                    "Cache-Control: no-cache, no-store, must-revalidate\r\n"
-                    "Pragma: no-cache\r\n"
-                    "Expires: 0\r\n"
-                    "Content-Type: text/html\r\n"
-                    "Content-Length: " + std::to_string(info.length()) + "\r\n"
-                    "\r\n" + info;
-
-
-                std::vector<uint8_t> buffer(response.begin(), response.end());
-
-                socket.send(buffer);
+                return requestStats(ReportType::HTML);
             }
             else if (fields[1] == "/stats.txt")
             {
-                std::string info;
-                relay.getStats(info, ReportType::TEXT);
-
-                std::string response = "HTTP/1.1 200 OK\r\n"
-                    "Cache-Control: no-cache, no-store, must-revalidate\r\n"
-                    "Pragma: no-cache\r\n"
-                    "Expires: 0\r\n"
-                    "Content-Type: text/plain\r\n"
-                    "Content-Length: " + std::to_string(info.length()) + "\r\n"
-                    "\r\n" + info;
-
-                std::vector<uint8_t> buffer(response.begin(), response.end());
-
-                socket.send(buffer);
+                return requestStats(ReportType::TEXT);
             }
             else if (fields[1] == "/stats.json")
             {
+                return requestStats(ReportType::JSON);
+            }
+            else if (fields[1] == "/metrics")
+            {
+                // read from the counters, the workers are not asked for a report
                 std::string info;
-                relay.getStats(info, ReportType::JSON);
-
-                std::string response = "HTTP/1.1 200 OK\r\n"
-                    "Cache-Control: no-cache, no-store, must-revalidate\r\n"
-                    "Pragma: no-cache\r\n"
-                    "Expires: 0\r\n"
-                    "Content-Type: application/json\r\n"
-                    "Content-Length: " + std::to_string(info.length()) + "\r\n"
-                    "\r\n" + info;
-
-                std::vector<uint8_t> buffer(response.begin(), response.end());
+                Metrics::getMetrics(info);
 
-                socket.send(buffer);
+                sendResponse("text/plain; version=0.0.4", info);
             }
             else
             {
@@ -135,6 +122,71 @@ namespace relay
         {
             sendError();
         }
+
+        return true;
+    }
+
+    bool StatusSender::requestStats(ReportType reportType)
+    {
+        // the workers report on their own threads, so the loop of the relay is not blocked while they answer
+        statsReport = relay.requestStats(reportType);
+
+        if (statsReport->pending == 0)
+        {
+            sendStats();
+            return true;
+        }
+
+        statsReport->completeCallback = std::bind(&StatusSender::handleStatsComplete, this);
+        statsTimer.start(STATS_TIMEOUT, std::bind(&StatusSender::handleStatsTimeout, this, std::placeholders::_1));
+
+        return false;
+    }
+
+    void StatusSender::sendStats()
+    {
+        std::string info;
+        Relay::formatStats(statsReport->stats, statsReport->reportType, info);
+
+        switch (statsReport->reportType)
+        {
+            case ReportType::TEXT: sendResponse("text/plain", info); break;
+            case ReportType::HTML: sendResponse("text/html", info); break;
+            case ReportType::JSON: sendResponse("application/json", info); break;
+        }
+
+        statsReport->completeCallback = nullptr;
+        statsReport.reset();
+        statsTimer.stop();
+    }
+
+    void StatusSender::handleStatsComplete()
+    {
+        sendStats();
+        socket.close();
+        relay.cleanup();
+    }
+
+    void StatusSender::handleStatsTimeout(Timer&)
+    {
+        // the workers that have not answered are reported empty
+        RELAY_LOG(Log::Level::WARN) << "Workers did not report statistics in time, " << statsReport->pending << " missing";
+        handleStatsComplete();
+    }
+
+    void StatusSender::sendResponse(const std::string& contentType, const std::string& body)
+    {
+        std::string response = "HTTP/1.1 200 OK\r\n"
+            "Cache-Control: no-cache, no-store, must-revalidate\r\n"
+            "Pragma: no-cache\r\n"
+            "Expires: 0\r\n"
+            "Content-Type: " + contentType + "\r\n"
+            "Content-Length: " + std::to_string(body.length()) + "\r\n"
+            "\r\n" + body;
+
+        std::vector<uint8_t> buffer(response.begin(), response.end());
+
+        socket.send(std::move(buffer));
     }
 
     void StatusSender::sendError()
@@ -145,6 +197,6 @@ namespace relay
 
         std::vector<uint8_t> buffer(response.begin(), response.end());
 
-        socket.send(buffer);
+        socket.send(std::move(buffer));
     }
 }
@@ -4,11 +4,15 @@
 
 #pragma once
 
+#include <memory>
 #include "Socket.hpp"
+#include "Timer.hpp"
 
 namespace relay
 {
     class Relay;
+    struct StatsReport;
+    enum class ReportType;
 
     class StatusSender
     {
@@ -16,6 +20,7 @@ namespace relay
         StatusSender(Network& aNetwork,
                      Socket& aSocket,
                      Relay& aRelay);
+        ~StatusSender();
 
         StatusSender(const StatusSender&) = delete;
         StatusSender(StatusSender&&) = delete;
@@ -25,10 +30,16 @@ namespace relay
         bool isConnected() const { return socket.isReady(); }
         
     private:
-        void handleRead(Socket& clientSocket, const std::vector<uint8_t>& newData);
+        void handleRead(Socket& clientSocket, ByteQueue& newData);
         void handleClose(Socket& clientSocket);
 
-        void sendReport();
+        // returns false if the response is sent once the workers have reported
+        bool sendReport();
+        bool requestStats(ReportType reportType);
+        void sendStats();
+        void handleStatsComplete();
+        void handleStatsTimeout(Timer& timer);
+        void sendResponse(const std::string& contentType, const std::string& body);
         void sendError();
 
         Network& network;
@@ -39,5 +50,8 @@ namespace relay
 
         std::string startLine;
         std::vector<std::string> headers;
+
+        std::shared_ptr<StatsReport> statsReport;
+        Timer statsTimer;
     };
 }
@@ -7,6 +7,7 @@
 #include "Connection.hpp"
 #include "Relay.hpp"
 #include "Server.hpp"
+#include "Trace.hpp"
 
 namespace relay
 {
@@ -20,12 +21,17 @@ namespace relay
     {
         idString = "[ST:" + std::to_string(id) + " " + applicationName + "/" + streamName + "] ";
 
-        Log(Log::Level::INFO) << idString << "Create";
+        for (const Endpoint& endpoint : server.getEndpoints())
+        {
+            gopCacheSize = std::max(gopCacheSize, endpoint.gopCacheSize);
+        }
+
+        RELAY_LOG(Log::Level::INFO) << idString << "Create";
     }
 
     Stream::~Stream()
     {
-        Log(Log::Level::INFO) << idString << "Delete";
+        RELAY_LOG(Log::Level::INFO) << idString << "Delete";
     }
 
     void Stream::getStats(std::string& str, ReportType reportType) const
@@ -34,17 +40,30 @@ namespace relay
         {
             case ReportType::TEXT:
             {
-                str += "    Stream[" + std::to_string(id) + "]: " + applicationName + "/" + streamName + "\n";
+                str += "    Stream[" + std::to_string(id) + "]: " + applicationName + "/" + streamName;
+                if (latencyHistogram.getCount() > 0) str += ", latency p50/p99/p999 (ms): " + latencyHistogram.getPercentilesString();
+                str += "\n";
                 break;
             }
             case ReportType::HTML:
             {
                 str += "<b>Stream[" + std::to_string(id) + "]: " + applicationName + "/" + streamName + "</b>";
+                if (latencyHistogram.getCount() > 0) str += " latency p50/p99/p999 (ms): " + latencyHistogram.getPercentilesString();
                 break;
             }
             case ReportType::JSON:
             {
-                str += "{\"id\": " + std::to_string(id) + ", \"applicationName\":\"" + applicationName + "\", \"streamName\":\"" + streamName + "\", \"connections\": [";
+                str += "{\"id\": " + std::to_string(id) + ", \"applicationName\":\"" + applicationName + "\", \"streamName\":\"" + streamName + "\", ";
+
+                if (latencyHistogram.getCount() > 0)
+                {
+                    str += "\"latency\":{\"count\":" + std::to_string(latencyHistogram.getCount()) +
+                        ",\"p50\":" + std::to_string(latencyHistogram.getPercentile(0.5)) +
+                        ",\"p99\":" + std::to_string(latencyHistogram.getPercentile(0.99)) +
+                        ",\"p999\":" + std::to_string(latencyHistogram.getPercentile(0.999)) + "}, ";
+                }
+
+                str += "\"connections\": [";
             }
         }
     }
@@ -79,7 +98,7 @@ namespace relay
     {
         if (closed) return;
 
-        Log() << idString << "Stream start " << connection.getIdString();
+        RELAY_LOG(Log::Level::INFO) << idString << "Stream start " << connection.getIdString();
         if (connection.getDirection() == Connection::Direction::INPUT)
         {
             if (!inputConnection)
@@ -130,9 +149,11 @@ namespace relay
             {
                 connection.setStream(this);
 
-                if (!videoHeader.empty()) connection.sendVideoHeader(videoHeader);
-                if (!audioHeader.empty()) connection.sendAudioHeader(audioHeader);
+                if (!videoHeader.isEmpty()) connection.sendVideoHeader(videoHeader);
+                if (!audioHeader.isEmpty()) connection.sendAudioHeader(audioHeader);
                 if (metaData.getType() != amf::Node::Type::Unknown) connection.sendMetaData(metaData);
+
+                sendFrames(connection);
             }
         }
         else
@@ -145,10 +166,12 @@ namespace relay
     {
         if (closed) return;
 
-        Log() << idString << "Stream stop " << connection.getIdString();
+        RELAY_LOG(Log::Level::INFO) << idString << "Stream stop " << connection.getIdString();
         if (&connection == inputConnection)
         {
             streaming = false;
+            chunkCache.clear();
+            clearFrames();
             if (inputConnection->getType() == Connection::Type::HOST)
             {
                 inputConnection = nullptr;
@@ -192,10 +215,13 @@ namespace relay
         }
     }
 
-    void Stream::sendAudioHeader(const std::vector<uint8_t>& headerData)
+    void Stream::sendAudioHeader(const Buffer& headerData)
     {
         audioHeader = headerData;
 
+        // cached frames can not be decoded with the new header
+        clearFrames();
+
         for (Connection* outputConnection : outputConnections)
         {
             if (outputConnection->getDirection() == Connection::Direction::OUTPUT)
@@ -205,10 +231,13 @@ namespace relay
         }
     }
 
-    void Stream::sendVideoHeader(const std::vector<uint8_t>& headerData)
+    void Stream::sendVideoHeader(const Buffer& headerData)
     {
         videoHeader = headerData;
 
+        // cached frames can not be decoded with the new header
+        clearFrames();
+
         for (Connection* outputConnection : outputConnections)
         {
             if (outputConnection->getDirection() == Connection::Direction::OUTPUT)
@@ -218,24 +247,34 @@ namespace relay
         }
     }
 
-    void Stream::sendAudioFrame(uint64_t timestamp, const std::vector<uint8_t>& audioData)
+    void Stream::sendAudioFrame(uint64_t timestamp, const Buffer& audioData, std::chrono::steady_clock::time_point ingestTime)
     {
+        Trace::record(Trace::Event::FRAME_FORWARDED, inputConnection ? inputConnection->getId() : 0, id,
+                      timestamp, 0, audioData.getSize(), static_cast<uint8_t>(rtmp::MessageType::AUDIO_PACKET));
+
+        cacheFrame(false, timestamp, audioData, VideoFrameType::NONE);
+
         for (Connection* outputConnection : outputConnections)
         {
             if (outputConnection->getDirection() == Connection::Direction::OUTPUT)
             {
-                outputConnection->sendAudioFrame(timestamp, audioData);
+                outputConnection->sendAudioFrame(timestamp, audioData, ingestTime);
             }
         }
     }
 
-    void Stream::sendVideoFrame(uint64_t timestamp, const std::vector<uint8_t>& videoData, VideoFrameType frameType)
+    void Stream::sendVideoFrame(uint64_t timestamp, const Buffer& videoData, VideoFrameType frameType, std::chrono::steady_clock::time_point ingestTime)
     {
+        Trace::record(Trace::Event::FRAME_FORWARDED, inputConnection ? inputConnection->getId() : 0, id,
+                      timestamp, 0, videoData.getSize(), static_cast<uint8_t>(rtmp::MessageType::VIDEO_PACKET));
+
+        cacheFrame(true, timestamp, videoData, frameType);
+
         for (Connection* outputConnection : outputConnections)
         {
             if (outputConnection->getDirection() == Connection::Direction::OUTPUT)
             {
-                outputConnection->sendVideoFrame(timestamp, videoData, frameType);
+                outputConnection->sendVideoFrame(timestamp, videoData, frameType, ingestTime);
             }
         }
     }
@@ -264,6 +303,90 @@ namespace relay
         }
     }
 
+    void Stream::sendFrames(Connection& connection)
+    {
+        if (gopFrames.empty()) return;
+
+        const Endpoint* endpoint = connection.getEndpoint();
+
+        uint64_t firstTimestamp = gopFrames.front().timestamp;
+        uint64_t lastTimestamp = gopFrames.back().timestamp;
+        uint64_t duration = (lastTimestamp > firstTimestamp) ? lastTimestamp - firstTimestamp : 0;
+
+        // with low latency join the cached video is squeezed into the last joinLatency milliseconds before the live edge
+        bool compress = endpoint && endpoint->lowLatencyJoin && duration > endpoint->joinLatency;
+        uint64_t windowStart = 0;
+
+        if (compress)
+        {
+            windowStart = lastTimestamp - endpoint->joinLatency;
+        }
+
+        // the latency of the cached frames is measured from now, they are late on purpose
+        auto now = std::chrono::steady_clock::now();
+
+        for (const Frame& frame : gopFrames)
+        {
+            if (frame.video)
+            {
+                uint64_t timestamp = frame.timestamp;
+
+                if (compress && timestamp >= firstTimestamp)
+                {
+                    timestamp = windowStart + (timestamp - firstTimestamp) * endpoint->joinLatency / duration;
+                }
+
+                connection.sendVideoFrame(timestamp, frame.data, frame.frameType, now);
+            }
+            else
+            {
+                // audio is not needed for decoding, so the audio before the window is skipped
+                if (compress && frame.timestamp < windowStart) continue;
+
+                connection.sendAudioFrame(frame.timestamp, frame.data, now);
+            }
+        }
+    }
+
+    void Stream::cacheFrame(bool video, uint64_t timestamp, const Buffer& data, VideoFrameType frameType)
+    {
+        if (gopCacheSize == 0) return;
+
+        if (video && frameType == VideoFrameType::KEY)
+        {
+            clearFrames();
+        }
+        else if (gopFrames.empty() || gopOverflow)
+        {
+            // nothing can be decoded before the first key frame
+            return;
+        }
+
+        if (gopFramesSize + data.getSize() > gopCacheSize)
+        {
+            RELAY_LOG(Log::Level::INFO) << idString << "Group of pictures does not fit in the cache of " << gopCacheSize << " bytes";
+
+            clearFrames();
+            gopOverflow = true;
+            return;
+        }
+
+        Frame frame;
+        frame.video = video;
+        frame.timestamp = timestamp;
+        frame.data = data;
+        frame.frameType = frameType;
+        gopFrames.push_back(frame);
+        gopFramesSize += data.getSize();
+    }
+
+    void Stream::clearFrames()
+    {
+        gopFrames.clear();
+        gopFramesSize = 0;
+        gopOverflow = false;
+    }
+
     void Stream::getConnections(std::map<Connection*, Stream*>& cons)
     {
         if (inputConnection) cons[inputConnection] = this;
@@ -4,9 +4,13 @@
 
 #pragma once
 
+#include <chrono>
 #include <string>
 #include <vector>
 #include "Amf.hpp"
+#include "Buffer.hpp"
+#include "ChunkCache.hpp"
+#include "LatencyHistogram.hpp"
 #include "Socket.hpp"
 #include "Status.hpp"
 #include "Utils.hpp"
@@ -42,11 +46,15 @@ namespace relay
         void stop(Connection& connection);
 
         Connection* getInputConnection() const { return inputConnection; }
-
-        void sendAudioHeader(const std::vector<uint8_t>& headerData);
-        void sendVideoHeader(const std::vector<uint8_t>& headerData);
-        void sendAudioFrame(uint64_t timestamp, const std::vector<uint8_t>& audioData);
-        void sendVideoFrame(uint64_t timestamp, const std::vector<uint8_t>& videoData, VideoFrameType frameType);
+        ChunkCache& getChunkCache() { return chunkCache; }
+        // latency of the frames of all outputs, from the input receiving them until an output sent them
+        LatencyHistogram& getLatencyHistogram() { return latencyHistogram; }
+
+        void sendAudioHeader(const Buffer& headerData);
+        void sendVideoHeader(const Buffer& headerData);
+        // the ingest time is when the input received the frame
+        void sendAudioFrame(uint64_t timestamp, const Buffer& audioData, std::chrono::steady_clock::time_point ingestTime);
+        void sendVideoFrame(uint64_t timestamp, const Buffer& videoData, VideoFrameType frameType, std::chrono::steady_clock::time_point ingestTime);
         void sendMetaData(const amf::Node& newMetaData);
         void sendTextData(uint64_t timestamp, const amf::Node& textData);
 
@@ -57,6 +65,19 @@ namespace relay
         void getConnections(std::map<Connection*, Stream*>& cons);
 
     private:
+        // media frame kept for the outputs that join after its key frame
+        struct Frame
+        {
+            bool video;
+            uint64_t timestamp;
+            Buffer data;
+            VideoFrameType frameType;
+        };
+
+        void sendFrames(Connection& connection);
+        void cacheFrame(bool video, uint64_t timestamp, const Buffer& data, VideoFrameType frameType);
+        void clearFrames();
+
         const uint64_t id;
         bool closed = false;
         std::string idString;
@@ -71,9 +92,17 @@ namespace relay
         std::vector<Connection*> outputConnections;
 
         bool streaming = false;
-        std::vector<uint8_t> audioHeader;
-        std::vector<uint8_t> videoHeader;
+        Buffer audioHeader;
+        Buffer videoHeader;
         amf::Node metaData;
+        ChunkCache chunkCache;
+        LatencyHistogram latencyHistogram;
+
+        // frames since the last key frame, disabled when the size limit is 0
+        uint32_t gopCacheSize = 0;
+        std::vector<Frame> gopFrames;
+        size_t gopFramesSize = 0;
+        bool gopOverflow = false; // the group of pictures did not fit, wait for the next key frame
 
         std::vector<Connection*> connections;
     };
@@ -0,0 +1,43 @@
+//
+//  rtmp_relay
+//
+
+#include "StreamRegistry.hpp"
+#include "Stream.hpp"
+
+namespace relay
+{
+    Stream* StreamRegistry::find(const Server& server,
+                                 const std::string& applicationName,
+                                 const std::string& streamName) const
+    {
+        Key key = {&server, &applicationName, &streamName};
+
+        auto i = streams.find(key);
+
+        if (i == streams.end() || i->second->isClosed()) return nullptr;
+
+        return i->second;
+    }
+
+    void StreamRegistry::insert(Stream& stream)
+    {
+        Key key = {&stream.getServer(), &stream.getApplicationName(), &stream.getStreamName()};
+
+        // the old key points to the names of the replaced stream
+        streams.erase(key);
+        streams.insert(std::make_pair(key, &stream));
+    }
+
+    void StreamRegistry::erase(Stream& stream)
+    {
+        Key key = {&stream.getServer(), &stream.getApplicationName(), &stream.getStreamName()};
+
+        auto i = streams.find(key);
+
+        if (i != streams.end() && i->second == &stream)
+        {
+            streams.erase(i);
+        }
+    }
+}
@@ -0,0 +1,66 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+namespace relay
+{
+    class Server;
+    class Stream;
+
+    // open streams of a relay by server, application name and stream name
+    class StreamRegistry
+    {
+    public:
+        // the names are not copied, the key points to the names of the stream (or of the caller during a lookup)
+        struct Key
+        {
+            const Server* server;
+            const std::string* applicationName;
+            const std::string* streamName;
+
+            bool operator==(const Key& other) const
+            {
+                return server == other.server &&
+                    *applicationName == *other.applicationName &&
+                    *streamName == *other.streamName;
+            }
+        };
+
+        struct KeyHash
+        {
+            size_t operator()(const Key& key) const
+            {
+                size_t result = std::hash<const Server*>()(key.server);
+                result ^= std::hash<std::string>()(*key.applicationName) + 0x9e3779b9 + (result << 6) + (result >> 2);
+                result ^= std::hash<std::string>()(*key.streamName) + 0x9e3779b9 + (result << 6) + (result >> 2);
+                return result;
+            }
+        };
+
+        typedef std::unordered_map<Key, Stream*, KeyHash> Streams;
+
+        // returns nullptr if there is no open stream with the name
+        Stream* find(const Server& server,
+                     const std::string& applicationName,
+                     const std::string& streamName) const;
+
+        // replaces the stream with the same name
+        void insert(Stream& stream);
+        // removes the stream if it is the one registered with its name
+        void erase(Stream& stream);
+        void clear() { streams.clear(); }
+
+        const Streams& getStreams() const { return streams; }
+        size_t getSize() const { return streams.size(); }
+
+    private:
+        Streams streams;
+    };
+}
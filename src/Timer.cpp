@@ -0,0 +1,40 @@
+//
+//  rtmp_relay
+//
+
+#include <cmath>
+#include "Timer.hpp"
+#include "Network.hpp"
+
+namespace relay
+{
+    Timer::Timer(Network& aNetwork):
+        network(aNetwork)
+    {
+    }
+
+    Timer::~Timer()
+    {
+        stop();
+    }
+
+    void Timer::start(float timeout, const std::function<void(Timer&)>& newCallback, bool newRepeat)
+    {
+        stop();
+
+        callback = newCallback;
+        repeat = newRepeat;
+        interval = (timeout > 0.0f) ? static_cast<uint64_t>(std::ceil(timeout * 1000.0f)) : 0;
+        expires = network.getTicks() + interval;
+
+        network.addTimer(*this);
+    }
+
+    void Timer::stop()
+    {
+        if (active)
+        {
+            network.removeTimer(*this);
+        }
+    }
+}
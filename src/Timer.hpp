@@ -0,0 +1,51 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+namespace relay
+{
+    class Network;
+
+    // node of the circular lists that form the slots of the timer wheel
+    struct TimerNode
+    {
+        TimerNode* previous = this;
+        TimerNode* next = this;
+    };
+
+    class Timer: private TimerNode
+    {
+        friend Network;
+    public:
+        Timer(Network& aNetwork);
+        ~Timer();
+
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+        Timer(Timer&&) = delete;
+        Timer& operator=(Timer&&) = delete;
+
+        void start(float timeout, const std::function<void(Timer&)>& newCallback, bool newRepeat = false);
+        void stop();
+
+        bool isActive() const { return active; }
+
+    private:
+        Network& network;
+
+        std::function<void(Timer&)> callback;
+        uint64_t interval = 0; // in milliseconds
+        uint64_t expires = 0; // tick of the network timer wheel
+        uint32_t level = 0;
+        uint32_t slot = 0;
+        bool repeat = false;
+        bool active = false;
+    };
+}
@@ -0,0 +1,120 @@
+//
+//  rtmp_relay
+//
+
+#include <chrono>
+#include <cstring>
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <unistd.h>
+#endif
+#include "Trace.hpp"
+#include "Log.hpp"
+
+namespace relay
+{
+    static_assert(sizeof(Trace::Header) == 64, "Trace header must be 64 bytes");
+    static_assert(sizeof(Trace::Record) == 64, "Trace record must be 64 bytes");
+
+    std::atomic<bool> Trace::enabled(false);
+    Trace::Header* Trace::header = nullptr;
+    Trace::Record* Trace::records = nullptr;
+    size_t Trace::mappedSize = 0;
+
+    bool Trace::open(const std::string& path, uint64_t capacity)
+    {
+        close();
+
+#ifdef _WIN32
+        Log(Log::Level::ERR) << "Trace is not supported on Windows";
+        return false;
+#else
+        if (capacity == 0)
+        {
+            Log(Log::Level::ERR) << "Trace size must not be 0";
+            return false;
+        }
+
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+        if (fd == -1)
+        {
+            Log(Log::Level::ERR) << "Failed to open trace file " << path << ", error: " << errno;
+            return false;
+        }
+
+        size_t size = sizeof(Header) + capacity * sizeof(Record);
+
+        if (ftruncate(fd, static_cast<off_t>(size)) == -1)
+        {
+            Log(Log::Level::ERR) << "Failed to resize trace file " << path << ", error: " << errno;
+            ::close(fd);
+            return false;
+        }
+
+        void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        // the mapping keeps the file
+        ::close(fd);
+
+        if (data == MAP_FAILED)
+        {
+            Log(Log::Level::ERR) << "Failed to map trace file " << path << ", error: " << errno;
+            return false;
+        }
+
+        header = static_cast<Header*>(data);
+        records = reinterpret_cast<Record*>(static_cast<uint8_t*>(data) + sizeof(Header));
+        mappedSize = size;
+
+        header->magic = MAGIC;
+        header->version = VERSION;
+        header->recordSize = sizeof(Record);
+        header->capacity = capacity;
+        header->position.store(0);
+
+        return true;
+#endif
+    }
+
+    void Trace::close()
+    {
+        enabled = false;
+
+#ifndef _WIN32
+        if (header)
+        {
+            munmap(header, mappedSize);
+        }
+#endif
+
+        header = nullptr;
+        records = nullptr;
+        mappedSize = 0;
+    }
+
+    void Trace::write(Event event, uint64_t connectionId, uint64_t streamId,
+                      uint64_t timestamp, uint64_t position, size_t size, uint8_t messageType)
+    {
+        // writers claim the records, so the threads of all workers can trace at the same time
+        uint64_t index = header->position.fetch_add(1, std::memory_order_relaxed);
+        Record& record = records[index % header->capacity];
+
+        // the decoder skips the record while it is overwritten
+        reinterpret_cast<std::atomic<uint64_t>&>(record.sequence).store(0, std::memory_order_relaxed);
+
+        record.time = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+        record.connectionId = connectionId;
+        record.streamId = streamId;
+        record.timestamp = timestamp;
+        record.position = position;
+        record.size = static_cast<uint32_t>(size);
+        record.event = event;
+        record.messageType = messageType;
+        record.reserved = 0;
+        record.reserved2 = 0;
+
+        reinterpret_cast<std::atomic<uint64_t>&>(record.sequence).store(index + 1, std::memory_order_release);
+    }
+}
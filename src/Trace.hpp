@@ -0,0 +1,79 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace relay
+{
+    // binary trace of the frames that pass through the relay, written to a memory mapped ring file
+    class Trace
+    {
+    public:
+        enum class Event: uint8_t
+        {
+            NONE = 0,
+            FRAME_RECEIVED = 1, // input connection received a media message
+            FRAME_FORWARDED = 2, // stream starts sending the frame to its outputs
+            FRAME_QUEUED = 3, // output connection queued the frame, position is the end of it in the sent data
+            FRAME_DROPPED = 4, // output connection dropped the frame
+            CHUNKS_ENCODED = 5, // output connection got the chunks of the frame, position is the chunk size
+            SOCKET_WRITTEN = 6 // socket wrote data, position is the amount of data written so far
+        };
+
+        static const uint64_t MAGIC = 0x31435254504D5452; // "RTMPTRC1" in little endian
+        static const uint32_t VERSION = 1;
+
+        struct Header
+        {
+            uint64_t magic;
+            uint32_t version;
+            uint32_t recordSize;
+            uint64_t capacity; // records
+            std::atomic<uint64_t> position; // index of the next record
+            uint8_t reserved[32];
+        };
+
+        struct Record
+        {
+            uint64_t time; // nanoseconds of the steady clock
+            uint64_t connectionId;
+            uint64_t streamId;
+            uint64_t timestamp; // milliseconds of the media timestamp
+            uint64_t position;
+            uint32_t size; // bytes
+            Event event;
+            uint8_t messageType;
+            uint16_t reserved;
+            uint64_t reserved2;
+            uint64_t sequence; // index of the record plus one, written last
+        };
+
+        // maps the file with room for the given amount of records, tracing starts disabled
+        static bool open(const std::string& path, uint64_t capacity);
+        static void close();
+
+        static void setEnabled(bool newEnabled) { enabled = newEnabled && header; }
+        static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+        static void record(Event event, uint64_t connectionId, uint64_t streamId,
+                           uint64_t timestamp, uint64_t position, size_t size, uint8_t messageType = 0)
+        {
+            if (isEnabled()) write(event, connectionId, streamId, timestamp, position, size, messageType);
+        }
+
+    private:
+        static void write(Event event, uint64_t connectionId, uint64_t streamId,
+                          uint64_t timestamp, uint64_t position, size_t size, uint8_t messageType);
+
+        static std::atomic<bool> enabled;
+        static Header* header;
+        static Record* records;
+        static size_t mappedSize;
+    };
+}
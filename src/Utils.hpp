@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <string>
 #include <vector>
@@ -15,10 +16,11 @@ union IntFloat64
     double   f;
 };
 
+// the buffer has the given size, so that a part of a larger allocation can be decoded
 template <class T>
-inline uint32_t decodeIntBE(const std::vector<uint8_t>& buffer, uint32_t offset, uint32_t size, T& result)
+inline uint32_t decodeIntBE(const uint8_t* buffer, size_t bufferSize, uint32_t offset, uint32_t size, T& result)
 {
-    if (buffer.size() - offset < size)
+    if (bufferSize - offset < size)
     {
         return 0;
     }
@@ -27,7 +29,7 @@ inline uint32_t decodeIntBE(const std::vector<uint8_t>& buffer, uint32_t offset,
 
     for (uint32_t i = 0; i < size; ++i)
     {
-        result += static_cast<T>(*(buffer.data() + offset)) << 8 * (size - i - 1);
+        result += static_cast<T>(*(buffer + offset)) << 8 * (size - i - 1);
         offset += 1;
     }
 
@@ -35,23 +37,29 @@ inline uint32_t decodeIntBE(const std::vector<uint8_t>& buffer, uint32_t offset,
 }
 
 template <>
-inline uint32_t decodeIntBE<uint8_t>(const std::vector<uint8_t>& buffer, uint32_t offset, uint32_t size, uint8_t& result)
+inline uint32_t decodeIntBE<uint8_t>(const uint8_t* buffer, size_t bufferSize, uint32_t offset, uint32_t size, uint8_t& result)
 {
-    if (buffer.size() - offset < size)
+    if (bufferSize - offset < size)
     {
         return 0;
     }
 
-    result = static_cast<uint8_t>(*(buffer.data() + offset));
+    result = static_cast<uint8_t>(*(buffer + offset));
     offset += 1;
 
     return size;
 }
 
 template <class T>
-inline uint32_t decodeIntLE(const std::vector<uint8_t>& buffer, uint32_t offset, uint32_t size, T& result)
+inline uint32_t decodeIntBE(const std::vector<uint8_t>& buffer, uint32_t offset, uint32_t size, T& result)
+{
+    return decodeIntBE(buffer.data(), buffer.size(), offset, size, result);
+}
+
+template <class T>
+inline uint32_t decodeIntLE(const uint8_t* buffer, size_t bufferSize, uint32_t offset, uint32_t size, T& result)
 {
-    if (buffer.size() - offset < size)
+    if (bufferSize - offset < size)
     {
         return 0;
     }
@@ -60,7 +68,7 @@ inline uint32_t decodeIntLE(const std::vector<uint8_t>& buffer, uint32_t offset,
 
     for (uint32_t i = 0; i < size; ++i)
     {
-        result += static_cast<T>(*(buffer.data() + offset)) << 8 * i;
+        result += static_cast<T>(*(buffer + offset)) << 8 * i;
         offset += 1;
     }
 
@@ -68,19 +76,25 @@ inline uint32_t decodeIntLE(const std::vector<uint8_t>& buffer, uint32_t offset,
 }
 
 template <>
-inline uint32_t decodeIntLE<uint8_t>(const std::vector<uint8_t>& buffer, uint32_t offset, uint32_t size, uint8_t& result)
+inline uint32_t decodeIntLE<uint8_t>(const uint8_t* buffer, size_t bufferSize, uint32_t offset, uint32_t size, uint8_t& result)
 {
-    if (buffer.size() - offset < size)
+    if (bufferSize - offset < size)
     {
         return 0;
     }
 
-    result = *(buffer.data() + offset);
+    result = *(buffer + offset);
     offset += 1;
-    
+
     return size;
 }
 
+template <class T>
+inline uint32_t decodeIntLE(const std::vector<uint8_t>& buffer, uint32_t offset, uint32_t size, T& result)
+{
+    return decodeIntLE(buffer.data(), buffer.size(), offset, size, result);
+}
+
 inline uint32_t decodeDouble(const std::vector<uint8_t>& buffer, uint32_t offset, double& result)
 {
     if (buffer.size() - offset < 8)
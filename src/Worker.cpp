@@ -0,0 +1,97 @@
+//
+//  rtmp_relay
+//
+
+#ifdef __linux__
+#  include <sched.h>
+#endif
+#ifndef _WIN32
+#  include <pthread.h>
+#  include <signal.h>
+#endif
+#include "Worker.hpp"
+#include "Log.hpp"
+
+namespace relay
+{
+    bool Worker::setAffinity(uint32_t core)
+    {
+#ifdef __linux__
+        uint32_t cores = std::thread::hardware_concurrency();
+
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(cores ? core % cores : core, &cpuSet);
+
+        int error = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+
+        if (error != 0)
+        {
+            Log(Log::Level::WARN) << "Failed to set the affinity of worker " << core << ", error: " << error;
+            return false;
+        }
+
+        return true;
+#else
+        (void)core;
+        return false;
+#endif
+    }
+
+    Worker::Worker(uint32_t aIndex):
+        index(aIndex), relay(network)
+    {
+    }
+
+    Worker::~Worker()
+    {
+        stop();
+    }
+
+    void Worker::start()
+    {
+#ifndef _WIN32
+        // the thread inherits the signal mask, so the signal handler only runs on the main thread
+        sigset_t signalSet;
+        sigemptyset(&signalSet);
+        sigaddset(&signalSet, SIGHUP);
+        sigaddset(&signalSet, SIGTERM);
+        sigaddset(&signalSet, SIGUSR1);
+        sigaddset(&signalSet, SIGUSR2);
+
+        sigset_t oldSignalSet;
+        int error = pthread_sigmask(SIG_BLOCK, &signalSet, &oldSignalSet);
+
+        if (error != 0)
+        {
+            Log(Log::Level::WARN) << "Failed to block signals for worker " << index << ", error: " << error;
+        }
+#endif
+
+        thread = std::thread(&Worker::run, this);
+
+#ifndef _WIN32
+        if (error == 0) pthread_sigmask(SIG_SETMASK, &oldSignalSet, nullptr);
+#endif
+    }
+
+    void Worker::stop()
+    {
+        if (thread.joinable())
+        {
+            relay.post(std::bind(&Relay::close, &relay));
+            thread.join();
+        }
+    }
+
+    void Worker::run()
+    {
+        setAffinity(index);
+
+        RELAY_LOG(Log::Level::INFO) << "Worker " << index << " started";
+
+        relay.run();
+
+        RELAY_LOG(Log::Level::INFO) << "Worker " << index << " stopped";
+    }
+}
@@ -0,0 +1,42 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <thread>
+#include "Network.hpp"
+#include "Relay.hpp"
+
+namespace relay
+{
+    class Worker
+    {
+    public:
+        static bool setAffinity(uint32_t core);
+
+        Worker(uint32_t aIndex);
+        ~Worker();
+
+        Worker(const Worker&) = delete;
+        Worker(Worker&&) = delete;
+        Worker& operator=(const Worker&) = delete;
+        Worker& operator=(Worker&&) = delete;
+
+        uint32_t getIndex() const { return index; }
+        Relay& getRelay() { return relay; }
+
+        void start();
+        void stop();
+
+    private:
+        void run();
+
+        const uint32_t index;
+
+        Network network;
+        Relay relay;
+
+        std::thread thread;
+    };
+}
@@ -15,6 +15,7 @@
 #include "Constants.hpp"
 #include "Relay.hpp"
 #include "Log.hpp"
+#include "Trace.hpp"
 #include "Version.hpp"
 
 using namespace relay;
@@ -49,6 +50,10 @@ static void signalHandler(int signo)
             Log(Log::Level::INFO) << str;
             break;
         }
+        case SIGUSR2:
+            Trace::setEnabled(!Trace::isEnabled());
+            Log(Log::Level::INFO) << "Trace " << (Trace::isEnabled() ? "enabled" : "disabled");
+            break;
         case SIGPIPE:
             Log(Log::Level::ERR) << "Received SIGPIPE";
             break;
@@ -260,6 +265,12 @@ int main(int argc, const char* argv[])
         return EXIT_FAILURE;
     }
 
+    if (std::signal(SIGUSR2, signalHandler) == SIG_ERR)
+    {
+        Log(Log::Level::ERR) << "Failed to capure SIGUSR2";
+        return EXIT_FAILURE;
+    }
+
     if (std::signal(SIGPIPE, signalHandler) == SIG_ERR)
     {
         Log(Log::Level::ERR) << "Failed to capure SIGPIPE";
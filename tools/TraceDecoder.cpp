@@ -0,0 +1,236 @@
+//
+//  rtmp_relay
+//
+//  Decodes the binary trace of the relay
+//  Usage: trace_decoder [--latency] <trace file>
+//
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "../src/Trace.hpp"
+
+using namespace relay;
+
+static const char* eventToString(Trace::Event event)
+{
+    switch (event)
+    {
+        case Trace::Event::FRAME_RECEIVED: return "FRAME_RECEIVED";
+        case Trace::Event::FRAME_FORWARDED: return "FRAME_FORWARDED";
+        case Trace::Event::FRAME_QUEUED: return "FRAME_QUEUED";
+        case Trace::Event::FRAME_DROPPED: return "FRAME_DROPPED";
+        case Trace::Event::CHUNKS_ENCODED: return "CHUNKS_ENCODED";
+        case Trace::Event::SOCKET_WRITTEN: return "SOCKET_WRITTEN";
+        default: return "UNKNOWN";
+    }
+}
+
+static bool isEarlier(const Trace::Record& a, const Trace::Record& b)
+{
+    return a.time < b.time;
+}
+
+static bool readTrace(const char* path, std::vector<Trace::Record>& records)
+{
+    std::ifstream file(path, std::ios::binary);
+
+    if (!file)
+    {
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    if (data.size() < sizeof(Trace::Header))
+    {
+        std::cerr << "File is too small" << std::endl;
+        return false;
+    }
+
+    // the header contains an atomic, so the fields are copied one by one
+    uint64_t magic;
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t capacity;
+    uint64_t position;
+    memcpy(&magic, data.data() + offsetof(Trace::Header, magic), sizeof(magic));
+    memcpy(&version, data.data() + offsetof(Trace::Header, version), sizeof(version));
+    memcpy(&recordSize, data.data() + offsetof(Trace::Header, recordSize), sizeof(recordSize));
+    memcpy(&capacity, data.data() + offsetof(Trace::Header, capacity), sizeof(capacity));
+    memcpy(&position, data.data() + offsetof(Trace::Header, position), sizeof(position));
+
+    if (magic != Trace::MAGIC || version != Trace::VERSION || recordSize != sizeof(Trace::Record))
+    {
+        std::cerr << "Not a trace file or unsupported version" << std::endl;
+        return false;
+    }
+
+    if (capacity == 0 || data.size() < sizeof(Trace::Header) + capacity * sizeof(Trace::Record))
+    {
+        std::cerr << "Trace file is truncated" << std::endl;
+        return false;
+    }
+
+    // the oldest records were overwritten once the ring wrapped around
+    uint64_t first = (position > capacity) ? position - capacity : 0;
+
+    for (uint64_t index = first; index < position; ++index)
+    {
+        Trace::Record record;
+        memcpy(&record, data.data() + sizeof(Trace::Header) + (index % capacity) * sizeof(Trace::Record), sizeof(record));
+
+        // skip the records that were being written
+        if (record.sequence == index + 1) records.push_back(record);
+    }
+
+    std::stable_sort(records.begin(), records.end(), isEarlier);
+
+    return true;
+}
+
+static void printRecords(const std::vector<Trace::Record>& records)
+{
+    uint64_t startTime = records.empty() ? 0 : records.front().time;
+
+    std::cout << "time_us,event,connection,stream,timestamp,position,size,message_type\n";
+
+    for (const Trace::Record& record : records)
+    {
+        std::cout << (record.time - startTime) / 1000.0 << ","
+            << eventToString(record.event) << ","
+            << record.connectionId << ","
+            << record.streamId << ","
+            << record.timestamp << ","
+            << record.position << ","
+            << record.size << ","
+            << static_cast<uint32_t>(record.messageType) << "\n";
+    }
+}
+
+static uint64_t getPercentile(std::vector<uint64_t>& values, double percentile)
+{
+    if (values.empty()) return 0;
+
+    size_t index = static_cast<size_t>(percentile * (values.size() - 1));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+static void printSummary(const char* name, std::vector<uint64_t>& values)
+{
+    std::cout << name << " (us): count " << values.size();
+
+    if (!values.empty())
+    {
+        uint64_t p50 = getPercentile(values, 0.5);
+        uint64_t p99 = getPercentile(values, 0.99);
+        uint64_t max = *std::max_element(values.begin(), values.end());
+        std::cout << ", p50 " << p50 / 1000 << ", p99 " << p99 / 1000 << ", max " << max / 1000;
+    }
+
+    std::cout << "\n";
+}
+
+// latency from the arrival of a frame until an output wrote its last byte, and the skew between the outputs
+static void printLatency(const std::vector<Trace::Record>& records)
+{
+    typedef std::tuple<uint64_t, uint8_t, uint64_t> FrameKey; // stream, message type, timestamp
+
+    std::map<FrameKey, uint64_t> receiveTimes;
+    std::map<FrameKey, std::pair<uint64_t, uint64_t>> writeTimes; // first and last output
+    std::map<uint64_t, std::vector<std::pair<FrameKey, uint64_t>>> pendingFrames; // queued frames and their end position by connection
+    std::vector<uint64_t> latencies;
+    uint64_t dropped = 0;
+
+    for (const Trace::Record& record : records)
+    {
+        switch (record.event)
+        {
+            case Trace::Event::FRAME_RECEIVED:
+                receiveTimes[FrameKey(record.streamId, record.messageType, record.timestamp)] = record.time;
+                break;
+            case Trace::Event::FRAME_QUEUED:
+                pendingFrames[record.connectionId].push_back(std::make_pair(FrameKey(record.streamId, record.messageType, record.timestamp), record.position));
+                break;
+            case Trace::Event::FRAME_DROPPED:
+                ++dropped;
+                break;
+            case Trace::Event::SOCKET_WRITTEN:
+            {
+                std::vector<std::pair<FrameKey, uint64_t>>& frames = pendingFrames[record.connectionId];
+                size_t written = 0;
+
+                while (written < frames.size() && frames[written].second <= record.position)
+                {
+                    const FrameKey& key = frames[written].first;
+                    auto receiveTime = receiveTimes.find(key);
+
+                    if (receiveTime != receiveTimes.end())
+                    {
+                        latencies.push_back(record.time - receiveTime->second);
+
+                        auto writeTime = writeTimes.find(key);
+                        if (writeTime == writeTimes.end())
+                            writeTimes[key] = std::make_pair(record.time, record.time);
+                        else
+                            writeTime->second.second = record.time;
+                    }
+
+                    ++written;
+                }
+
+                frames.erase(frames.begin(), frames.begin() + written);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    std::vector<uint64_t> skews;
+    for (const auto& writeTime : writeTimes)
+    {
+        skews.push_back(writeTime.second.second - writeTime.second.first);
+    }
+
+    std::cout << "Frames received: " << receiveTimes.size() << ", dropped by outputs: " << dropped << "\n";
+    printSummary("Relay latency", latencies);
+    printSummary("Fan-out skew", skews);
+}
+
+int main(int argc, const char* argv[])
+{
+    bool latency = false;
+    const char* path = nullptr;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::string(argv[i]) == "--latency") latency = true;
+        else path = argv[i];
+    }
+
+    if (!path)
+    {
+        std::cerr << "Usage: " << argv[0] << " [--latency] <trace file>" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::vector<Trace::Record> records;
+    if (!readTrace(path, records)) return EXIT_FAILURE;
+
+    if (latency) printLatency(records);
+    else printRecords(records);
+
+    return EXIT_SUCCESS;
+}